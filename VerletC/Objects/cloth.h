@@ -30,24 +30,45 @@ struct Cloth : public Composite {
 	float min;
 	int segments;
 	
-	Cloth(VerletJS* sim, Vec2 origin, float width, float height, int segments, int pinMod, float stiffness):segments(segments) {
+	// grid links that tore, two per particle: to the left and to the one above
+	vector<bool> torn;
+	
+	Cloth(VerletJS* sim, Vec2 origin, float width, float height, int segments, int pinMod, float stiffness):Cloth(sim, segments) {
+		build(origin, width, height, pinMod, stiffness, true);
+		sim->composites.push_back(this);
+	}
+	
+protected:
+	// particles only, for GridCloth which keeps its links out of the constraint list
+	Cloth(VerletJS* sim, int segments):Composite(&sim->store), segments(segments) {}
+	
+	// links: create the distance constraints between neighbors
+	void build(Vec2 origin, float width, float height, int pinMod, float stiffness, bool links) {
 		float xStride = width/segments;
 		float yStride = height/segments;
 		
 		min = fmin(width,height);
 		
+		int pins = (segments + pinMod-1)/pinMod;
+		int count = links ? 2*segments*(segments-1) : 0;
+		
+		store->reserve(first + segments*segments);
+		particles.reserve(segments*segments);
+		constraints.reserve(count + pins);
+		arena.reserve(segments*segments*sizeof(Particle) + count*sizeof(DistanceConstraint) + pins*sizeof(PinConstraint));
+		
 		int x,y;
 		for (y=0;y<segments;++y) {
 			for (x=0;x<segments;++x) {
 				float px = origin.x + x*xStride - width/2 + xStride/2;
 				float py = origin.y + y*yStride - height/2 + yStride/2;
-				particles.push_back(new Particle(Vec2(px, py)));
+				particles.push_back(make<Particle>(store, Vec2(px, py)));
 				
-				if (x > 0)
-					constraints.push_back(new DistanceConstraint(particles[y*segments+x], particles[y*segments+x-1], stiffness));
+				if (links && x > 0)
+					constraints.push_back(make<DistanceConstraint>(particles[y*segments+x], particles[y*segments+x-1], stiffness));
 				
-				if (y > 0)
-					constraints.push_back(new DistanceConstraint(particles[y*segments+x], particles[(y-1)*segments+x], stiffness));
+				if (links && y > 0)
+					constraints.push_back(make<DistanceConstraint>(particles[y*segments+x], particles[(y-1)*segments+x], stiffness));
 			}
 		}
 		
@@ -55,16 +76,34 @@ struct Cloth : public Composite {
 			if (x%pinMod == 0)
 				pin(x);
 		}
-		
-		sim->composites.push_back(this);
 	}
 	
-	void drawParticles() {
+public:
+	// links tear once stretched beyond ratio times their length, 0 for never
+	void tear(float ratio) {
+		int c;
+		for (c=0; c<constraints.size(); c++)
+			if (constraints[c]->type & Constraint::DISTANCE)
+				static_cast<DistanceConstraint*>(constraints[c])->tear = ratio;
+		invalidate();
+	}
+	
+	void tore(DistanceConstraint* constraint) {
+		int a = constraint->a->index - first;
+		int b = constraint->b->index - first;
+		if (torn.empty())
+			torn.assign(2*segments*segments, false);
+		torn[2*a + (b == a-1 ? 0 : 1)] = true;
+	}
+	
+	void drawParticles(Renderer& r) {
 		// do nothing for particles
 	}
 	
-	void drawConstraints() {
+	void drawConstraints(Renderer& r) {
 		float stride = min/segments;
+		float* px = store->x.data() + first;
+		float* py = store->y.data() + first;
 		int x,y;
 		for (y=1;y<segments;++y) {
 			for (x=1;x<segments;++x) {
@@ -72,31 +111,19 @@ struct Cloth : public Composite {
 				int i1 = (y-1)*segments+x-1;
 				int i2 = (y)*segments+x;
 				
-				float off = particles[i2]->pos.x - particles[i1]->pos.x;
-				off += particles[i2]->pos.y - particles[i1]->pos.y;
+				// a cell with a torn side leaves a hole
+				if (!torn.empty() && (torn[2*(i1+1)] || torn[2*i2] || torn[2*(i2-1)+1] || torn[2*i2+1]))
+					continue;
+				
+				float off = px[i2] - px[i1];
+				off += py[i2] - py[i1];
 				off *= 0.25;
 				
 				float coef = fabsf(off)/stride;
 				if (coef > 1.0)
 					coef = 1.0;
 				
-				glColor4f(coef, 0, 1.0-coef, lerp(0.25,1.0,coef));
-				
-				glEnable(GL_BLEND);
-				glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-				
-				glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-				
-				glBegin(GL_POLYGON);
-				{
-					glVertex2f(particles[i1]->pos.x, particles[i1]->pos.y);
-					glVertex2f(particles[i1+1]->pos.x, particles[i1+1]->pos.y);
-					glVertex2f(particles[i2]->pos.x, particles[i2]->pos.y);
-					glVertex2f(particles[i2-1]->pos.x, particles[i2-1]->pos.y);
-					
-				}glEnd();
-				
-				glDisable(GL_BLEND);
+				r.quad(Vec2(px[i1], py[i1]), Vec2(px[i1+1], py[i1+1]), Vec2(px[i2], py[i2]), Vec2(px[i2-1], py[i2-1]), Color::fromFloat(coef, 0, 1.0-coef, lerp(0.25,1.0,coef)));
 			}
 		}
 		
@@ -104,9 +131,7 @@ struct Cloth : public Composite {
 		for (c=0; c<constraints.size(); c++) {
 			if (constraints[c]->type & Constraint::PIN) {
 				PinConstraint* point = (PinConstraint*)constraints[c];
-				glColor4ub(255, 255, 255, 255);
-				glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-				drawCircle(point->pos, 1.2f);
+				r.circle(point->pos, 1.2f, Color(255, 255, 255));
 			}
 		}
 	}
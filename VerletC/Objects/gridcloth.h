@@ -0,0 +1,226 @@
+/*
+ Copyright 2013 Sub Protocol and other contributors
+ http://subprotocol.com/
+ 
+ Permission is hereby granted, free of charge, to any person obtaining
+ a copy of this software and associated documentation files (the
+ "Software"), to deal in the Software without restriction, including
+ without limitation the rights to use, copy, modify, merge, publish,
+ distribute, sublicense, and/or sell copies of the Software, and to
+ permit persons to whom the Software is furnished to do so, subject to
+ the following conditions:
+ 
+ The above copyright notice and this permission notice shall be
+ included in all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+// GridCloth -- a Cloth whose grid links are not constraint objects. The links of a
+// row and those to the row above are relaxed straight from the position arrays:
+// horizontal links in two passes (even, then odd) and vertical links side by side,
+// so that no link of a pass depends on another and the loops vectorize. Rest
+// lengths and stiffness are uniform, as Cloth creates them.
+//
+// Several iterations are relaxed in one sweep down the rows: iteration k+1 relaxes
+// a row right after iteration k is done with the row below, which gives the same
+// result as whole iterations one after the other while the rows in flight stay in
+// cache. GridCloth<N> fixes the grid at N x N at compile time and is built without
+// a segments argument. Only the pins are in the constraint list, so saveSnapshot
+// refuses worlds with a GridCloth.
+
+#pragma once
+
+#include "cloth.h"
+
+// n independent links between a[i*stride] and b[i*stride], as relaxDistance
+template<int Stride>
+inline void relaxGridLinks(float* __restrict ax, float* __restrict ay, float* __restrict bx, float* __restrict by, int n, float distance, float stiffness, float stepCoef) {
+	int i;
+	for (i=0; i<n; i++) {
+		float nx = ax[i*Stride]-bx[i*Stride];
+		float ny = ay[i*Stride]-by[i*Stride];
+		float m = nx*nx + ny*ny;
+		float coef = ((distance*distance - m)/m)*stiffness*stepCoef;
+		nx *= coef;
+		ny *= coef;
+		ax[i*Stride] += nx;
+		ay[i*Stride] += ny;
+		bx[i*Stride] -= nx;
+		by[i*Stride] -= ny;
+	}
+}
+
+template<int Segments = 0>
+struct GridCloth : public Cloth {
+	float xRest;
+	float yRest;
+	float stiffness;
+	
+	// rows in flight of one sweep are kept within this many bytes (L2)
+	static const int sweepBytes = 256*1024;
+	
+	// pins by row for the sweep, rebuilt on every call
+	vector<int> pinStart;
+	vector<int> pinOrder;
+	
+	GridCloth(VerletJS* sim, Vec2 origin, float width, float height, int segments, int pinMod, float stiffness):Cloth(sim, segments), stiffness(stiffness) {
+		static_assert(Segments == 0, "GridCloth<N> takes its segments from N");
+		init(sim, origin, width, height, pinMod);
+	}
+	
+	GridCloth(VerletJS* sim, Vec2 origin, float width, float height, int pinMod, float stiffness):Cloth(sim, Segments), stiffness(stiffness) {
+		static_assert(Segments > 0, "GridCloth<> needs a segments argument");
+		init(sim, origin, width, height, pinMod);
+	}
+	
+	// the rest of either constructor
+	void init(VerletJS* sim, Vec2 origin, float width, float height, int pinMod) {
+		xRest = width/segments;
+		yRest = height/segments;
+		build(origin, width, height, pinMod, stiffness, false);
+		sim->composites.push_back(this);
+	}
+	
+	// a constant when the size is a template argument
+	int columns() {
+		return Segments > 0 ? Segments : segments;
+	}
+	
+	int constraintCount() {
+		int n = columns();
+		return 2*n*(n-1) + (int)constraints.size();
+	}
+	
+	// links within row r and between rows r and r-1
+	void relaxRow(float* x, float* y, int r, float stepCoef) {
+		const int n = columns();
+		float* rx = x + first + r*n;
+		float* ry = y + first + r*n;
+		
+		relaxGridLinks<2>(rx, ry, rx+1, ry+1, n/2, xRest, stiffness, stepCoef);
+		relaxGridLinks<2>(rx+1, ry+1, rx+2, ry+2, (n-1)/2, xRest, stiffness, stepCoef);
+		if (r > 0)
+			relaxGridLinks<1>(rx, ry, rx-n, ry-n, n, yRest, stiffness, stepCoef);
+	}
+	
+	void relax(float stepCoef, ThreadPool* pool = NULL) {
+		{
+			PROFILE_SCOPE(PROFILE_RELAX_DISTANCE);
+			int r;
+			for (r=0; r<columns(); r++)
+				relaxRow(store->x.data(), store->y.data(), r, stepCoef);
+		}
+		Composite::relax(stepCoef, pool);
+	}
+	
+	void relax(float stepCoef, int iterations, ThreadPool* pool) {
+		// other constraints run after whole iterations
+		prepare(pool);
+		if (batches.distances.size() || batches.angles.size() || !batches.others.empty()) {
+			Composite::relax(stepCoef, iterations, pool);
+			return;
+		}
+		
+		PROFILE_SCOPE(PROFILE_RELAX_DISTANCE);
+		const int n = columns();
+		float* x = store->x.data();
+		float* y = store->y.data();
+		
+		// counting sort of the pins by row
+		PinBatch& pins = batches.pins;
+		int i, r;
+		pinStart.assign(n+1, 0);
+		for (i=0; i<pins.size(); i++)
+			pinStart[(pins.a[i]-first)/n+1]++;
+		for (r=0; r<n; r++)
+			pinStart[r+1] += pinStart[r];
+		pinOrder.resize(pins.size());
+		for (i=0; i<pins.size(); i++)
+			pinOrder[pinStart[(pins.a[i]-first)/n]++] = i;
+		for (r=n; r>0; r--)
+			pinStart[r] = pinStart[r-1];
+		pinStart[0] = 0;
+		
+		// a row is done for an iteration once the row below was relaxed, its pins are
+		// then applied and the next iteration may start on it
+		int depth = max(1, std::min(iterations, sweepBytes/(int)(2*n*sizeof(float)) - 1));
+		int done, t, k;
+		for (done=0; done<iterations; done+=depth) {
+			int passes = std::min(depth, iterations-done);
+			for (t=0; t<n+passes-1; t++) {
+				for (k=0; k<passes && t-k >= 0; k++) {
+					r = t-k;
+					if (r >= n)
+						continue;
+					relaxRow(x, y, r, stepCoef);
+					if (r > 0)
+						pinRow(x, y, r-1);
+					if (r == n-1)
+						pinRow(x, y, r);
+				}
+			}
+		}
+	}
+	
+	void pinRow(float* x, float* y, int r) {
+		PinBatch& pins = batches.pins;
+		int i;
+		for (i=pinStart[r]; i<pinStart[r+1]; i++) {
+			int p = pinOrder[i];
+			x[pins.a[p]] = pins.pins[p]->pos.x;
+			y[pins.a[p]] = pins.pins[p]->pos.y;
+		}
+	}
+};
+
+// the sweep matches iteration by iteration relaxation, the fixed size matches the
+// runtime size, and a GridCloth hangs like a Cloth up to the order of its links
+void test_GridCloth() {
+	VerletJS sim(800, 800);
+	Cloth* cloth = new Cloth(&sim, Vec2(400, 300), 500, 500, 40, 6, 0.9);
+	GridCloth<>* grid = new GridCloth<>(&sim, Vec2(400, 300), 500, 500, 40, 6, 0.9);
+	GridCloth<40>* fixed = new GridCloth<40>(&sim, Vec2(400, 300), 500, 500, 6, 0.9);
+	GridCloth<>* sweep = new GridCloth<>(&sim, Vec2(400, 300), 500, 500, 40, 6, 0.9);
+	
+	int i, s;
+	for (s=0; s<120; s++)
+		sim.update(1.0f/60);
+	
+	ParticleStore& p = sim.store;
+	float distance = 0, fixedDistance = 0;
+	for (i=0; i<grid->particles.size(); i++) {
+		int g = grid->begin()+i, f = fixed->begin()+i, c = cloth->begin()+i;
+		fixedDistance = max(fixedDistance, (Vec2(p.x[g], p.y[g]) - Vec2(p.x[f], p.y[f])).length());
+		distance = max(distance, (Vec2(p.x[g], p.y[g]) - Vec2(p.x[c], p.y[c])).length());
+	}
+	
+	// from the same moving state, one sweep of 16 iterations and 16 single iterations
+	for (i=0; i<grid->particles.size(); i++) {
+		int g = grid->begin()+i, w = sweep->begin()+i;
+		p.x[w] = p.x[g];
+		p.y[w] = p.y[g];
+		p.lastX[w] = p.lastX[g];
+		p.lastY[w] = p.lastY[g];
+	}
+	sim.integrate(grid->begin(), grid->end(), 1.0f/60);
+	sim.integrate(sweep->begin(), sweep->end(), 1.0f/60);
+	sweep->relax(1.0f/16, 16, NULL);
+	for (s=0; s<16; s++)
+		grid->relax(1.0f/16);
+	
+	bool same = true;
+	for (i=0; i<grid->particles.size(); i++)
+		same &= p.x[grid->begin()+i] == p.x[sweep->begin()+i] && p.y[grid->begin()+i] == p.y[sweep->begin()+i];
+	
+	cout << "GridCloth(sweep): " << (same ? "PASS" : "FAIL") << "\n";
+	cout << "GridCloth(fixed size): " << (fixedDistance < 1e-3f ? "PASS" : "FAIL") << " max distance " << fixedDistance << "\n";
+	cout << "GridCloth(like Cloth): " << (distance < 0.25f*grid->xRest ? "PASS" : "FAIL") << " max distance " << distance << "\n";
+}
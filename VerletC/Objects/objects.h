@@ -29,22 +29,22 @@
 #include "composite.h"
 
 struct Point : public Composite {
-	Point(VerletJS* sim, Vec2 pos) {
-		particles.push_back(new Particle(pos));
+	Point(VerletJS* sim, Vec2 pos): Composite(&sim->store) {
+		particles.push_back(make<Particle>(store, pos));
 		sim->composites.push_back(this);
 	}
 };
 
 struct LineSegments : public Composite {
 	template<int N>
-	LineSegments(VerletJS* sim, Vec2 (&vertices)[N], float stiffness) {
+	LineSegments(VerletJS* sim, Vec2 (&vertices)[N], float stiffness): Composite(&sim->store) {
 		int i;
 		int count = N;
 		
 		for (i=0; i<count; i++) {
-			particles.push_back(new Particle(vertices[i]));
+			particles.push_back(make<Particle>(store, vertices[i]));
 			if (i > 0)
-				constraints.push_back(new DistanceConstraint(particles[i], particles[i-1], stiffness));
+				constraints.push_back(make<DistanceConstraint>(particles[i], particles[i-1], stiffness));
 		}
 		
 		sim->composites.push_back(this);
@@ -52,24 +52,24 @@ struct LineSegments : public Composite {
 };
 
 struct Tire : public Composite {
-	Tire(VerletJS* sim, Vec2 origin, float radius, int segments, float spokeStiffness, float treadStiffness) {
+	Tire(VerletJS* sim, Vec2 origin, float radius, int segments, float spokeStiffness, float treadStiffness): Composite(&sim->store) {
 		float stride = (2*M_PI)/segments;
 		int i;
 		
 		// particles
 		for (i=0;i<segments;++i) {
 			float theta = i*stride;
-			particles.push_back(new Particle(Vec2(origin.x + cosf(theta)*radius, origin.y + sinf(theta)*radius)));
+			particles.push_back(make<Particle>(store, Vec2(origin.x + cosf(theta)*radius, origin.y + sinf(theta)*radius)));
 		}
 		
-		Particle* center = new Particle(origin);
+		Particle* center = make<Particle>(store, origin);
 		particles.push_back(center);
 		
 		// constraints
 		for (i=0;i<segments;++i) {
-			constraints.push_back(new DistanceConstraint(particles[i], particles[(i+1)%segments], treadStiffness));
-			constraints.push_back(new DistanceConstraint(particles[i], center, spokeStiffness));
-			constraints.push_back(new DistanceConstraint(particles[i], particles[(i+5)%segments], treadStiffness));
+			constraints.push_back(make<DistanceConstraint>(particles[i], particles[(i+1)%segments], treadStiffness));
+			constraints.push_back(make<DistanceConstraint>(particles[i], center, spokeStiffness));
+			constraints.push_back(make<DistanceConstraint>(particles[i], particles[(i+5)%segments], treadStiffness));
 		}
 		
 		sim->composites.push_back(this);
@@ -25,10 +25,15 @@
 #pragma once
 
 #include "composite.h"
+#include "spatialhash.h"
+
+#include <algorithm>
 
 struct Spiderweb : public Composite {
+	SpatialHash hash;
+	bool hashDirty = true;
 	
-	Spiderweb(VerletJS* sim, Vec2 origin, float radius, int segments, int depth) {
+	Spiderweb(VerletJS* sim, Vec2 origin, float radius, int segments, int depth): Composite(&sim->store) {
 		
 		float stiffness = 0.6;
 		float tensor = 0.3;
@@ -43,7 +48,7 @@ struct Spiderweb : public Composite {
 			float shrinkingRadius = radius - radiusStride*i + cosf(i*0.1)*20;
 			
 			float offy = cosf(theta*2.1)*(radius/depth)*0.2;
-			particles.push_back(new Particle(Vec2(origin.x + cosf(theta)*shrinkingRadius, origin.y + sinf(theta)*shrinkingRadius + offy)));
+			particles.push_back(make<Particle>(store, Vec2(origin.x + cosf(theta)*shrinkingRadius, origin.y + sinf(theta)*shrinkingRadius + offy)));
 		}
 		
 		for (i=0;i<segments;i+=4)
@@ -52,17 +57,17 @@ struct Spiderweb : public Composite {
 		// constraints
 		for (i=0;i<n-1;++i) {
 			// neighbor
-			constraints.push_back(new DistanceConstraint(particles[i], particles[i+1], stiffness));
+			constraints.push_back(make<DistanceConstraint>(particles[i], particles[i+1], stiffness));
 			
 			// span rings
 			float off = i + segments;
 			if (off < n-1)
-				constraints.push_back(new DistanceConstraint(particles[i], particles[off], stiffness));
+				constraints.push_back(make<DistanceConstraint>(particles[i], particles[off], stiffness));
 			else
-				constraints.push_back(new DistanceConstraint(particles[i], particles[n-1], stiffness));
+				constraints.push_back(make<DistanceConstraint>(particles[i], particles[n-1], stiffness));
 		}
 		
-		constraints.push_back(new DistanceConstraint(particles[0], particles[segments-1], stiffness));
+		constraints.push_back(make<DistanceConstraint>(particles[0], particles[segments-1], stiffness));
 		
 		// strech the web
 		for (c=0;c<constraints.size();c++)
@@ -74,14 +79,24 @@ struct Spiderweb : public Composite {
 		sim->composites.push_back(this);
 	}
 	
-	void drawParticles() {
+	// index over the web for Spider::crawl, rebuilt on the first query after a step
+	SpatialHash& index(float cellSize) {
+		if (hashDirty || hash.cellSize != cellSize) {
+			hash.build(store->x.data(), store->y.data(), begin(), end(), cellSize);
+			hashDirty = false;
+		}
+		return hash;
+	}
+	
+	void update(float dt) {
+		hashDirty = true;
+	}
+	
+	void drawParticles(Renderer& r) {
 		int i;
 		for (i=0; i<particles.size(); i++) {
 			Particle* point = particles[i];
-			
-			glColor3ub(45, 173, 143);
-			glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-			drawCircle(point->pos, 1.3);
+			r.circle(point->getPos(), 1.3, Color(45, 173, 143));
 		}
 	}
 };
@@ -96,7 +111,17 @@ struct Spider : public Composite {
 	
 	Spiderweb* spiderweb = NULL;
 	
-	Spider(VerletJS* sim, Spiderweb* spiderweb, Vec2 origin): spiderweb(spiderweb) {
+	// the world's generator, crawling draws from it
+	Random* random;
+	
+	// the constraint holding each leg to the web, stale while it hangs free
+	SlotHandle footholds[8];
+	
+	// constraint of a leg that hangs free, kept for its next step since the arena
+	// does not reuse memory
+	DistanceConstraint* hanging[8] = {NULL};
+	
+	Spider(VerletJS* sim, Spiderweb* spiderweb, Vec2 origin): Composite(&sim->store), spiderweb(spiderweb), random(&sim->random) {
 		int i;
 		float legSeg1Stiffness = 0.99;
 		float legSeg2Stiffness = 0.99;
@@ -110,28 +135,29 @@ struct Spider : public Composite {
 		float bodyStiffness = 1;
 		float bodyJointStiffness = 1;
 		
-		head = new Particle(origin+Vec2(0,-5));
-		thorax = new Particle(origin);
-		abdomen = new Particle(origin+Vec2(0,10));
+		// created in the same order as they are listed in particles
+		thorax = make<Particle>(store, origin);
+		head = make<Particle>(store, origin+Vec2(0,-5));
+		abdomen = make<Particle>(store, origin+Vec2(0,10));
 		
 		particles.push_back(thorax);
 		particles.push_back(head);
 		particles.push_back(abdomen);
 		
-		constraints.push_back(new DistanceConstraint(head, thorax, bodyStiffness));
+		constraints.push_back(make<DistanceConstraint>(head, thorax, bodyStiffness));
 		
-		constraints.push_back(new DistanceConstraint(abdomen, thorax, bodyStiffness));
-		constraints.push_back(new AngleConstraint(abdomen, thorax, head, 0.4));
+		constraints.push_back(make<DistanceConstraint>(abdomen, thorax, bodyStiffness));
+		constraints.push_back(make<AngleConstraint>(abdomen, thorax, head, 0.4));
 		
 		// legs
 		for (i=0;i<4;++i) {
-			particles.push_back(new Particle(particles[0]->pos+Vec2(3,(i-1.5)*3)));
-			particles.push_back(new Particle(particles[0]->pos+Vec2(-3,(i-1.5)*3)));
+			particles.push_back(make<Particle>(store, particles[0]->getPos()+Vec2(3,(i-1.5)*3)));
+			particles.push_back(make<Particle>(store, particles[0]->getPos()+Vec2(-3,(i-1.5)*3)));
 			
 			int len = (int)particles.size();
 			
-			constraints.push_back(new DistanceConstraint(particles[len-2], thorax, legSeg1Stiffness));
-			constraints.push_back(new DistanceConstraint(particles[len-1], thorax, legSeg1Stiffness));
+			constraints.push_back(make<DistanceConstraint>(particles[len-2], thorax, legSeg1Stiffness));
+			constraints.push_back(make<DistanceConstraint>(particles[len-1], thorax, legSeg1Stiffness));
 			
 			
 			float lenCoef = 1;
@@ -140,23 +166,23 @@ struct Spider : public Composite {
 			else if (i == 3)
 				lenCoef = 0.9;
 			
-			particles.push_back(new Particle(particles[len-2]->pos+(Vec2(20,(i-1.5)*30)).normal()*20*lenCoef));
-			particles.push_back(new Particle(particles[len-1]->pos+(Vec2(-20,(i-1.5)*30)).normal()*20*lenCoef));
+			particles.push_back(make<Particle>(store, particles[len-2]->getPos()+(Vec2(20,(i-1.5)*30)).normal()*20*lenCoef));
+			particles.push_back(make<Particle>(store, particles[len-1]->getPos()+(Vec2(-20,(i-1.5)*30)).normal()*20*lenCoef));
 			
 			len = (int)particles.size();
-			constraints.push_back(new DistanceConstraint(particles[len-4], particles[len-2], legSeg2Stiffness));
-			constraints.push_back(new DistanceConstraint(particles[len-3], particles[len-1], legSeg2Stiffness));
+			constraints.push_back(make<DistanceConstraint>(particles[len-4], particles[len-2], legSeg2Stiffness));
+			constraints.push_back(make<DistanceConstraint>(particles[len-3], particles[len-1], legSeg2Stiffness));
 			
-			particles.push_back(new Particle(particles[len-2]->pos+(Vec2(20,(i-1.5)*50)).normal()*20*lenCoef));
-			particles.push_back(new Particle(particles[len-1]->pos+(Vec2(-20,(i-1.5)*50)).normal()*20*lenCoef));
+			particles.push_back(make<Particle>(store, particles[len-2]->getPos()+(Vec2(20,(i-1.5)*50)).normal()*20*lenCoef));
+			particles.push_back(make<Particle>(store, particles[len-1]->getPos()+(Vec2(-20,(i-1.5)*50)).normal()*20*lenCoef));
 			
 			len = (int)particles.size();
-			constraints.push_back(new DistanceConstraint(particles[len-4], particles[len-2], legSeg3Stiffness));
-			constraints.push_back(new DistanceConstraint(particles[len-3], particles[len-1], legSeg3Stiffness));
+			constraints.push_back(make<DistanceConstraint>(particles[len-4], particles[len-2], legSeg3Stiffness));
+			constraints.push_back(make<DistanceConstraint>(particles[len-3], particles[len-1], legSeg3Stiffness));
 			
 			
-			Particle* rightFoot = new Particle(particles[len-2]->pos+(Vec2(20,(i-1.5)*100)).normal()*12*lenCoef);
-			Particle* leftFoot = new Particle(particles[len-1]->pos+(Vec2(-20,(i-1.5)*100)).normal()*12*lenCoef);
+			Particle* rightFoot = make<Particle>(store, particles[len-2]->getPos()+(Vec2(20,(i-1.5)*100)).normal()*12*lenCoef);
+			Particle* leftFoot = make<Particle>(store, particles[len-1]->getPos()+(Vec2(-20,(i-1.5)*100)).normal()*12*lenCoef);
 			particles.push_back(rightFoot);
 			particles.push_back(leftFoot);
 			
@@ -164,43 +190,41 @@ struct Spider : public Composite {
 			legs.push_back(leftFoot);
 			
 			len = (int)particles.size();
-			constraints.push_back(new DistanceConstraint(particles[len-4], particles[len-2], legSeg4Stiffness));
-			constraints.push_back(new DistanceConstraint(particles[len-3], particles[len-1], legSeg4Stiffness));
+			constraints.push_back(make<DistanceConstraint>(particles[len-4], particles[len-2], legSeg4Stiffness));
+			constraints.push_back(make<DistanceConstraint>(particles[len-3], particles[len-1], legSeg4Stiffness));
 			
 			
-			constraints.push_back(new AngleConstraint(particles[len-6], particles[len-4], particles[len-2], joint3Stiffness));
-			constraints.push_back(new AngleConstraint(particles[len-6+1], particles[len-4+1], particles[len-2+1], joint3Stiffness));
+			constraints.push_back(make<AngleConstraint>(particles[len-6], particles[len-4], particles[len-2], joint3Stiffness));
+			constraints.push_back(make<AngleConstraint>(particles[len-6+1], particles[len-4+1], particles[len-2+1], joint3Stiffness));
 			
-			constraints.push_back(new AngleConstraint(particles[len-8], particles[len-6], particles[len-4], joint2Stiffness));
-			constraints.push_back(new AngleConstraint(particles[len-8+1], particles[len-6+1], particles[len-4+1], joint2Stiffness));
+			constraints.push_back(make<AngleConstraint>(particles[len-8], particles[len-6], particles[len-4], joint2Stiffness));
+			constraints.push_back(make<AngleConstraint>(particles[len-8+1], particles[len-6+1], particles[len-4+1], joint2Stiffness));
 			
-			constraints.push_back(new AngleConstraint(particles[0], particles[len-8], particles[len-6], joint1Stiffness));
-			constraints.push_back(new AngleConstraint(particles[0], particles[len-8+1], particles[len-6+1], joint1Stiffness));
+			constraints.push_back(make<AngleConstraint>(particles[0], particles[len-8], particles[len-6], joint1Stiffness));
+			constraints.push_back(make<AngleConstraint>(particles[0], particles[len-8+1], particles[len-6+1], joint1Stiffness));
 			
-			constraints.push_back(new AngleConstraint(particles[1], particles[0], particles[len-8], bodyJointStiffness));
-			constraints.push_back(new AngleConstraint(particles[1], particles[0], particles[len-8+1], bodyJointStiffness));
+			constraints.push_back(make<AngleConstraint>(particles[1], particles[0], particles[len-8], bodyJointStiffness));
+			constraints.push_back(make<AngleConstraint>(particles[1], particles[0], particles[len-8+1], bodyJointStiffness));
 		}
 		
 		sim->composites.push_back(this);
 	}
 	
-	void drawConstraints() {
+	void drawConstraints(Renderer& r) {
 		int i;
 		
-		glColor3ub(0, 0, 0);
-		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+		Color color = Color(0, 0, 0);
 		
-		drawCircle(head->pos, 4);
+		r.circle(head->getPos(), 4, color);
 		
-		drawCircle(thorax->pos, 4);
+		r.circle(thorax->getPos(), 4, color);
 		
-		drawCircle(abdomen->pos, 8);
+		r.circle(abdomen->getPos(), 8, color);
 		
 		for (i=3;i<constraints.size();++i) {
 			if (constraints[i]->type & Constraint::DISTANCE) {
 				DistanceConstraint* constraint = (DistanceConstraint*)constraints[i];
-				glLineWidth(1.0);
-				drawLine(constraint->a->pos, constraint->b->pos);
+				r.line(constraint->a->getPos(), constraint->b->getPos(), 1.0, color);
 				
 				// draw legs
 				if (
@@ -209,31 +233,33 @@ struct Spider : public Composite {
 					|| (i >= (2*17)+1 && i <= (2*17)+2)
 					|| (i >= (2*25)+1 && i <= (2*25)+2)
 					) {
-					glLineWidth(3);
-					drawLine(constraint->a->pos, constraint->b->pos);
+					r.line(constraint->a->getPos(), constraint->b->getPos(), 3, color);
 				} else if (
 						   (i >= 4 && i <= 6)
 						   || (i >= (2*9)+3 && i <= (2*9)+4)
 						   || (i >= (2*17)+3 && i <= (2*17)+4)
 						   || (i >= (2*25)+3 && i <= (2*25)+4)
 						   ) {
-					glLineWidth(2);
-					drawLine(constraint->a->pos, constraint->b->pos);
+					r.line(constraint->a->getPos(), constraint->b->getPos(), 2, color);
 				} else if (
 						   (i >= 6 && i <= 8)
 						   || (i >= (2*9)+5 && i <= (2*9)+6)
 						   || (i >= (2*17)+5 && i <= (2*17)+6)
 						   || (i >= (2*25)+5 && i <= (2*25)+6)
 						   ) {
-					glLineWidth(1.5);
-					drawLine(constraint->a->pos, constraint->b->pos);
+					r.line(constraint->a->getPos(), constraint->b->getPos(), 1.5, color);
 				} else {
 				}
 			}
 		}
 	}
 	
-	void drawParticles() {
+	void drawParticles(Renderer& r) {
+	}
+	
+	DistanceConstraint* foothold(int leg) {
+		Constraint** constraint = constraints.get(footholds[leg]);
+		return constraint ? static_cast<DistanceConstraint*>(*constraint) : NULL;
 	}
 	
 	void crawl(int leg) {
@@ -243,7 +269,7 @@ struct Spider : public Composite {
 		float stepRadius = 100;
 		float minStepRadius = 35;
 		
-		float theta = particles[0]->pos.angle2(particles[0]->pos+Vec2(1,0), particles[1]->pos);
+		float theta = particles[0]->getPos().angle2(particles[0]->getPos()+Vec2(1,0), particles[1]->getPos());
 		
 		Vec2 boundry1 = Vec2(cosf(theta), sinf(theta));
 		Vec2 boundry2 = Vec2(cosf(theta+M_PI/2), sinf(theta+M_PI/2));
@@ -252,57 +278,73 @@ struct Spider : public Composite {
 		float flag1 = leg < 4 ? 1 : -1;
 		float flag2 = leg%2 == 0 ? 1 : 0;
 		
+		Vec2 origin = particles[0]->getPos();
+		float* x = store->x.data();
+		float* y = store->y.data();
+		
 		Particles paths;
 		
-		int i;
-		for (i=0; i<spiderweb->particles.size(); i++) {
-			if (
-				(spiderweb->particles[i]->pos-particles[0]->pos).dot(boundry1)*flag1 >= 0
-				&& (spiderweb->particles[i]->pos-particles[0]->pos).dot(boundry2)*flag2 >= 0
-				) {
-				float d2 = spiderweb->particles[i]->pos.dist2(particles[0]->pos);
-				
-				if (!(d2 >= minStepRadius*minStepRadius && d2 <= stepRadius*stepRadius))
-					continue;
-				
-				bool leftFoot = false;
-				int j;
-				for (j=0; j<constraints.size(); j++) {
-					int k;
-					for (k=0;k<8;++k) {
-						if (constraints[j]->type & Constraint::DISTANCE) {
-							DistanceConstraint* constraint = (DistanceConstraint*)constraints[j];
-							if (constraint->a == legs[k] && constraint->b == spiderweb->particles[i])
-								leftFoot = true;
-						}
-					}
-				}
-				
-				if (!leftFoot)
-					paths.push_back(spiderweb->particles[i]);
-			}
-		}
+		spiderweb->index(stepRadius).query(origin, stepRadius, [&](int i) {
+			Vec2 pos = Vec2(x[i], y[i]);
+			if (!((pos-origin).dot(boundry1)*flag1 >= 0 && (pos-origin).dot(boundry2)*flag2 >= 0))
+				return;
+			
+			float d2 = pos.dist2(origin);
+			if (!(d2 >= minStepRadius*minStepRadius && d2 <= stepRadius*stepRadius))
+				return;
+			
+			// skip the threads some leg already stands on
+			int k;
+			for (k=0;k<8;++k)
+				if (foothold(k) && foothold(k)->b->index == i)
+					return;
+			
+			paths.push_back(spiderweb->particles[i - spiderweb->first]);
+		});
 		
-		for(Constraints::iterator it=constraints.begin(); it!=constraints.end(); it++) {
-			if (((Constraint*)*it)->type & Constraint::DISTANCE) {
-				DistanceConstraint* constraint = (DistanceConstraint*)*it;
-				if (constraint->a == legs[leg]) {
-					constraints.erase(it);
-					break;
-				}
-			}
-		}
+		// keep the candidates in web order, the random pick depends on it
+		sort(paths.begin(), paths.end(), [](Particle* a, Particle* b) {
+			return a->index < b->index;
+		});
 		
 		if (paths.size() > 0) {
-			random_shuffle(paths.begin(), paths.end());
-			constraints.push_back(new DistanceConstraint(legs[leg], paths[0], 1, 0));
+			Particle* path = paths[random->below((int)paths.size())];
+			
+			if (foothold(leg)) {
+				retarget(foothold(leg), path);
+			} else {
+				DistanceConstraint* constraint = hanging[leg];
+				if (constraint) {
+					constraint->~DistanceConstraint();
+					new (constraint) DistanceConstraint(legs[leg], path, 1, 0);
+					hanging[leg] = NULL;
+				} else {
+					constraint = make<DistanceConstraint>(legs[leg], path, 1, 0);
+				}
+				footholds[leg] = constraints.insert(constraint);
+				invalidate();
+			}
+		} else if (foothold(leg)) {
+			// nowhere to step, the leg hangs free
+			hanging[leg] = static_cast<DistanceConstraint*>(detach(footholds[leg]));
 		}
 	}
 	
 	void update(float dt) {
 		// animation loop
-		if (floor(random()%4) == 0) {
+		if (random->below(4) == 0) {
 			crawl(((legIndex++)*3)%8);
 		}
 	}
+	
+	Composite* dependency() {
+		return spiderweb;
+	}
+	
+	~Spider() {
+		int i;
+		for (i=0; i<8; i++)
+			if (hanging[i])
+				destroy(hanging[i]);
+	}
 };
@@ -36,7 +36,7 @@ struct TreeBranch : public DistanceConstraint {
 
 struct TreeLeaf : public Particle {
 	bool leaf = false;
-	TreeLeaf(Vec2 pos): Particle(pos) {}
+	TreeLeaf(ParticleStore* store, Vec2 pos): Particle(store, pos) {}
 };
 
 struct Tree : public Composite {
@@ -48,9 +48,9 @@ struct Tree : public Composite {
 	
 	float theta;
 	
-	Tree(VerletJS* sim, Vec2 origin, int depth, float branchLength, float segmentCoef, float theta): branchLength(branchLength), theta(theta) {
-		Particle* base = new Particle(origin);
-		Particle* root = new Particle(origin+Vec2(0,10));
+	Tree(VerletJS* sim, Vec2 origin, int depth, float branchLength, float segmentCoef, float theta): Composite(&sim->store), branchLength(branchLength), theta(theta) {
+		Particle* base = make<Particle>(store, origin);
+		Particle* root = make<Particle>(store, origin+Vec2(0,10));
 		
 		particles.push_back(base);
 		particles.push_back(root);
@@ -59,22 +59,22 @@ struct Tree : public Composite {
 		
 		Particle* firstBranch = branch(base, 0, depth, segmentCoef, Vec2(0,-1));
 		
-		constraints.push_back(new AngleConstraint(root, base, firstBranch, 1));
+		constraints.push_back(make<AngleConstraint>(root, base, firstBranch, 1));
 		
 		// animates the tree at the beginning
 		float noise = 10;
 		int i;
 		for (i=0;i<particles.size();++i)
-			particles[i]->pos += Vec2(floor(rand()/(float)RAND_MAX*noise), floor(rand()/(float)RAND_MAX*noise));
+			particles[i]->setPos(particles[i]->getPos() + Vec2(floor(sim->random.uniform()*noise), floor(sim->random.uniform()*noise)));
 		
 		sim->composites.push_back(this);
 	}
 	
 	Particle* branch(Particle* parent, int i, int nMax, float coef, Vec2 normal) {
-		TreeLeaf* particle = new TreeLeaf(parent->pos+(normal*branchLength*coef));
+		TreeLeaf* particle = make<TreeLeaf>(store, parent->getPos()+(normal*branchLength*coef));
 		particles.push_back(particle);
 		
-		TreeBranch* dc = new TreeBranch(parent, particle, lineCoef);
+		TreeBranch* dc = make<TreeBranch>(parent, particle, lineCoef);
 		dc->p = i/(float)nMax; // a hint for drawing
 		constraints.push_back(dc);
 		
@@ -86,16 +86,16 @@ struct Tree : public Composite {
 			Particle* b = branch(particle, i+1, nMax, coef*coef, normal.rotate(Vec2(0,0), theta));
 			
 			float jointStrength = lerp(0.7, 0, i/nMax);
-			constraints.push_back(new AngleConstraint(parent, particle, a, jointStrength));
-			constraints.push_back(new AngleConstraint(parent, particle, b, jointStrength));
+			constraints.push_back(make<AngleConstraint>(parent, particle, a, jointStrength));
+			constraints.push_back(make<AngleConstraint>(parent, particle, b, jointStrength));
 		}
 		
 		return particle;
 	}
 	
-	void drawParticles() {
+	void drawParticles(Renderer& r) {
 		if (debugDraw) {
-			Composite::drawParticles();
+			Composite::drawParticles(r);
 			return;
 		}
 		
@@ -103,28 +103,25 @@ struct Tree : public Composite {
 		for (i=0;i<particles.size();++i) {
 			TreeLeaf* particle = (TreeLeaf*)particles[i];
 			if (particle->leaf) {
-				glColor3ub(103, 157, 124);
-				glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-				drawCircle(particle->pos, 25.0f);
+				r.circle(particle->getPos(), 25.0f, Color(103, 157, 124));
 			}
 		}
 	}
 	
-	void drawConstraints() {
+	void drawConstraints(Renderer& r) {
 		if (debugDraw) {
-			Composite::drawConstraints();
+			Composite::drawConstraints(r);
 			return;
 		}
 		
 		int i;
 		
-		glColor3ub(84, 51, 36);
+		Color color = Color(84, 51, 36);
 		
 		for (i=0;i<constraints.size();++i) {
 			TreeBranch* constraint = (TreeBranch*)constraints[i];
 			if (constraint->type & Constraint::DISTANCE) {
-				glLineWidth(lerp(10.0f,2.0f,constraint->p));
-				drawLine(constraint->a->pos, constraint->b->pos);
+				r.line(constraint->a->getPos(), constraint->b->getPos(), lerp(10.0f,2.0f,constraint->p), color);
 			}
 		}
 	}
@@ -0,0 +1,87 @@
+// Arena -- bump allocator for objects that live as long as their owner. Memory
+// comes in blocks that double in size and is only given back all at once, so
+// building a scene costs a handful of allocations whatever its size.
+
+#pragma once
+
+#include <vector>
+#include <stdlib.h>
+#include <stdint.h>
+
+using namespace std;
+
+struct Arena {
+	struct Block {
+		char* data;
+		size_t size;
+	};
+	
+	vector<Block> blocks;
+	char* cursor = NULL;
+	char* limit = NULL;
+	
+	// size of the next block
+	size_t blockSize = 4096;
+	
+	Arena() {}
+	
+	// blocks are owned, copies would free them twice
+	Arena(const Arena&) = delete;
+	Arena& operator=(const Arena&) = delete;
+	
+	void* allocate(size_t size, size_t align) {
+		char* p = aligned(cursor, align);
+		if (!cursor || p + size > limit) {
+			grow(size + align);
+			p = aligned(cursor, align);
+		}
+		cursor = p + size;
+		return p;
+	}
+	
+	// makes room for bytes more without further blocks
+	void reserve(size_t bytes) {
+		if (!cursor || cursor + bytes > limit)
+			grow(bytes);
+	}
+	
+	bool owns(const void* p) {
+		int i;
+		for (i=(int)blocks.size()-1; i>=0; i--)
+			if (p >= blocks[i].data && p < blocks[i].data + blocks[i].size)
+				return true;
+		return false;
+	}
+	
+	// frees every block, objects must have been destroyed already
+	void release() {
+		int i;
+		for (i=0; i<blocks.size(); i++)
+			free(blocks[i].data);
+		blocks.clear();
+		cursor = limit = NULL;
+	}
+	
+	~Arena() {
+		release();
+	}
+	
+	static char* aligned(char* p, size_t align) {
+		return (char*)(((uintptr_t)p + align-1) & ~(uintptr_t)(align-1));
+	}
+	
+	void grow(size_t bytes) {
+		size_t size = blockSize;
+		while (size < bytes)
+			size <<= 1;
+		blockSize = size << 1;
+		
+		Block block;
+		block.data = (char*)malloc(size);
+		block.size = size;
+		blocks.push_back(block);
+		
+		cursor = block.data;
+		limit = block.data + size;
+	}
+};
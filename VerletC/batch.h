@@ -0,0 +1,109 @@
+// WorldBatch -- owns many independent worlds and steps them concurrently, one
+// world per task, for parameter sweeps that would otherwise need a process each.
+
+#pragma once
+
+#include "verlet.h"
+
+#include <chrono>
+
+struct WorldResult {
+	int steps = 0;
+	double seconds = 0;
+	int particles = 0;
+	int constraints = 0;
+	
+	// constraint relaxations run, fewer than constraints*iterations per step with VerletJS::adaptive
+	double relaxations = 0;
+};
+
+struct WorldBatch {
+	vector<VerletJS*> worlds;
+	vector<WorldResult> results;
+	
+	// NULL uses ThreadPool::shared()
+	ThreadPool* pool = NULL;
+	
+	// dispatch order, most expensive world first so that the last tasks are short
+	vector<int> order;
+	
+	WorldBatch(ThreadPool* pool = NULL): pool(pool) {}
+	
+	int size() {
+		return (int)worlds.size();
+	}
+	
+	// takes ownership of world
+	VerletJS* add(VerletJS* world) {
+		order.push_back(size());
+		worlds.push_back(world);
+		results.push_back(WorldResult());
+		return world;
+	}
+	
+	// adds n worlds of the given size and calls setup(world, index) on each concurrently,
+	// index counts from 0 for this call
+	void create(int n, int width, int height, function<void(VerletJS*, int)> setup) {
+		int first = size();
+		int i;
+		for (i=0; i<n; i++)
+			add(new VerletJS(width, height));
+		
+		threads().parallelFor(0, n, 1, [&](int begin, int end) {
+			int i;
+			for (i=begin; i<end; i++)
+				setup(worlds[first+i], i);
+		});
+	}
+	
+	// advances every world by steps updates of dt, results add up across calls
+	void step(int steps, float dt, int iterations = 16) {
+		// a shared cursor hands out one world at a time, so threads that finish
+		// early keep taking worlds until none are left
+		threads().parallelFor(0, size(), 1, [&](int begin, int end) {
+			int i, s, c;
+			for (i=begin; i<end; i++) {
+				int w = order[i];
+				VerletJS* world = worlds[w];
+				
+				WorldResult& r = results[w];
+				
+				chrono::steady_clock::time_point start = chrono::steady_clock::now();
+				for (s=0; s<steps; s++) {
+					world->update(dt, iterations);
+					r.relaxations += world->relaxations();
+				}
+				
+				r.steps += steps;
+				r.seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+				r.particles = world->store.size();
+				r.constraints = 0;
+				for (c=0; c<world->composites.size(); c++)
+					r.constraints += world->composites[c]->constraintCount();
+			}
+		});
+		
+		sort(order.begin(), order.end(), [this](int a, int b) {
+			return results[a].seconds/max(results[a].steps, 1) > results[b].seconds/max(results[b].steps, 1);
+		});
+	}
+	
+	// time spent in all worlds, larger than the wall time when running in parallel
+	double seconds() {
+		double s = 0;
+		int i;
+		for (i=0; i<size(); i++)
+			s += results[i].seconds;
+		return s;
+	}
+	
+	ThreadPool& threads() {
+		return pool ? *pool : ThreadPool::shared();
+	}
+	
+	~WorldBatch() {
+		int i;
+		for (i=0; i<size(); i++)
+			delete worlds[i];
+	}
+};
@@ -0,0 +1,231 @@
+// Collisions -- contacts between particles that have a radius. Candidate pairs are
+// found once per step through a uniform grid and projected apart in every relax
+// iteration, so the cost of a step only depends on the number of close pairs.
+
+#pragma once
+
+#include "composite.h"
+#include "spatialhash.h"
+#include "random.h"
+
+#include <algorithm>
+
+struct Collisions {
+	// extra distance under which pairs are kept as candidates for the whole step
+	float margin = 1.0f;
+	
+	SpatialHash grid;
+	vector<int> colliders;
+	
+	// composite owning each particle, -1 for particles of no composite
+	vector<int> owner;
+	
+	// candidate pairs and their contact distance
+	vector<int> a;
+	vector<int> b;
+	vector<float> distance;
+	
+	// colliders copied in grid order
+	vector<float> ex, ey, er;
+	vector<int> eo, ecx, ecy;
+	
+	void find(ParticleStore& store, Composites& composites) {
+		int i, c;
+		
+		a.clear();
+		b.clear();
+		distance.clear();
+		colliders.clear();
+		
+		owner.assign(store.size(), -1);
+		for (c=0; c<composites.size(); c++)
+			for (i=composites[c]->begin(); i<composites[c]->end(); i++)
+				owner[i] = c;
+		
+		float maxRadius = 0;
+		for (i=0; i<store.size(); i++) {
+			if (store.radius[i] > 0) {
+				colliders.push_back(i);
+				maxRadius = max(maxRadius, store.radius[i]);
+			}
+		}
+		
+		if (colliders.size() < 2)
+			return;
+		
+		float* x = store.x.data();
+		float* y = store.y.data();
+		float* radius = store.radius.data();
+		
+		// with cells as large as the largest contact distance, every pair
+		// lies in neighboring cells
+		float cellSize = 2*maxRadius + margin;
+		grid.build(x, y, colliders.data(), (int)colliders.size(), cellSize);
+		
+		// positions, radii, owners and cells in grid order, so that scanning a
+		// bucket reads contiguous memory instead of gathering from the whole store
+		int n = grid.size();
+		ex.resize(n);
+		ey.resize(n);
+		er.resize(n);
+		eo.resize(n);
+		ecx.resize(n);
+		ecy.resize(n);
+		for (i=0; i<n; i++) {
+			int p = grid.entries[i];
+			ex[i] = x[p];
+			ey[i] = y[p];
+			er[i] = radius[p];
+			eo[i] = owner[p];
+			ecx[i] = grid.cell(x[p]);
+			ecy[i] = grid.cell(y[p]);
+		}
+		
+		// each pair is met once: in the particle's own cell against later entries,
+		// and in the four cells ahead of it against every entry that is really in
+		// that cell rather than only sharing its bucket
+		static const int ahead[5][2] = {{0, 0}, {1, 0}, {-1, 1}, {0, 1}, {1, 1}};
+		
+		for (i=0; i<n; i++) {
+			int k, e;
+			for (k=0; k<5; k++) {
+				int cx = ecx[i] + ahead[k][0];
+				int cy = ecy[i] + ahead[k][1];
+				int bucket = grid.bucket(cx, cy);
+				
+				for (e=(k == 0 ? i+1 : grid.start[bucket]); e<grid.start[bucket+1]; e++) {
+					if (ecx[e] != cx || ecy[e] != cy)
+						continue;
+					
+					int op = eo[i], oq = eo[e];
+					if (op == oq && (op < 0 || !composites[op]->selfCollision))
+						continue;
+					
+					float contact = er[i] + er[e];
+					float rx = ex[e] - ex[i];
+					float ry = ey[e] - ey[i];
+					float reach = contact + margin;
+					if (rx*rx + ry*ry < reach*reach) {
+						a.push_back(grid.entries[i]);
+						b.push_back(grid.entries[e]);
+						distance.push_back(contact);
+					}
+				}
+			}
+		}
+	}
+	
+	int size() {
+		return (int)a.size();
+	}
+	
+	// pushes overlapping pairs apart, one iteration
+	void relax(float* x, float* y) {
+		int i, n = size();
+		for (i=0; i<n; i++) {
+			int p = a[i], q = b[i];
+			float nx = x[q] - x[p];
+			float ny = y[q] - y[p];
+			float m = nx*nx + ny*ny;
+			if (m >= distance[i]*distance[i] || m == 0)
+				continue;
+			
+			float d = sqrtf(m);
+			float coef = 0.5f*(distance[i] - d)/d;
+			nx *= coef;
+			ny *= coef;
+			x[p] -= nx;
+			y[p] -= ny;
+			x[q] += nx;
+			y[q] += ny;
+		}
+	}
+};
+
+// the grid finds the same candidate pairs as a check of every pair, each once:
+// random circles of four composites, two of them self-colliding, and loose ones;
+// some sit exactly on cell borders, and a few large ones cover many small ones
+// across several cells
+void test_Collisions() {
+	Random random(7);
+	bool ok = true;
+	int round, i, j;
+	for (round=0; round<3; round++) {
+		ParticleStore store;
+		Composites composites;
+		for (i=0; i<4; i++) {
+			Composite* composite = new Composite(&store);
+			composite->selfCollision = i%2 == 0;
+			for (j=0; j<150; j++)
+				composite->particles.push_back(new Particle(&store, Vec2(0, 0)));
+			composites.push_back(composite);
+		}
+		vector<Particle*> loose;
+		for (i=0; i<100; i++)
+			loose.push_back(new Particle(&store, Vec2(0, 0)));
+		
+		float large = round == 0 ? 0 : 12 + 10*round;
+		for (i=0; i<store.size(); i++) {
+			store.x[i] = store.lastX[i] = -80 + 160*random.uniform();
+			store.y[i] = store.lastY[i] = -80 + 160*random.uniform();
+			store.radius[i] = 0.5f + 2.5f*random.uniform();
+			if (i%37 == 0)
+				store.radius[i] = 0;
+			if (large > 0 && i%53 == 0)
+				store.radius[i] = large;
+		}
+		
+		// on the borders of the cells the grid will use
+		Collisions collisions;
+		float maxRadius = 0;
+		for (i=0; i<store.size(); i++)
+			maxRadius = max(maxRadius, store.radius[i]);
+		float cellSize = 2*maxRadius + collisions.margin;
+		for (i=0; i<store.size(); i+=11) {
+			store.x[i] = (random.below(8) - 4)*cellSize;
+			store.y[i] = (random.below(8) - 4)*cellSize + (i%2)*0.5f*store.radius[i];
+		}
+		
+		collisions.find(store, composites);
+		
+		vector<int> owner(store.size(), -1);
+		int c;
+		for (c=0; c<composites.size(); c++)
+			for (i=composites[c]->begin(); i<composites[c]->end(); i++)
+				owner[i] = c;
+		
+		vector<pair<int,int>> expected;
+		for (i=0; i<store.size(); i++) {
+			for (j=i+1; j<store.size(); j++) {
+				if (store.radius[i] <= 0 || store.radius[j] <= 0)
+					continue;
+				if (owner[i] == owner[j] && (owner[i] < 0 || !composites[owner[i]]->selfCollision))
+					continue;
+				
+				float rx = store.x[j] - store.x[i];
+				float ry = store.y[j] - store.y[i];
+				float reach = store.radius[i] + store.radius[j] + collisions.margin;
+				if (rx*rx + ry*ry < reach*reach)
+					expected.push_back(make_pair(i, j));
+			}
+		}
+		
+		vector<pair<int,int>> found;
+		for (i=0; i<collisions.size(); i++) {
+			int p = collisions.a[i], q = collisions.b[i];
+			ok &= collisions.distance[i] == store.radius[p] + store.radius[q];
+			found.push_back(make_pair(min(p, q), max(p, q)));
+		}
+		
+		sort(expected.begin(), expected.end());
+		sort(found.begin(), found.end());
+		ok &= !expected.empty() && found == expected;
+		
+		for (c=0; c<composites.size(); c++)
+			delete composites[c];
+		for (i=0; i<loose.size(); i++)
+			delete loose[i];
+	}
+	
+	cout << "Collisions: " << (ok ? "PASS" : "FAIL") << "\n";
+}
@@ -28,54 +28,227 @@
 
 #include "particle.h"
 #include "constraint.h"
+#include "arena.h"
 
 #include <vector>
+#include <new>
+#include <utility>
 
 using namespace std;
 
 struct Composite {
+	ParticleStore* store;
+	
+	// particles are allocated contiguously in the store,
+	// particles[i] lives at store index first+i
+	int first;
+	
 	Particles particles;
 	Constraints constraints;
 	
-	Composite(){}
+	// particles with a radius collide with those of other composites,
+	// and with each other when selfCollision is set
+	bool selfCollision = false;
+	
+	// backs the particles and constraints created with make()
+	Arena arena;
+	
+	// flattened copy of constraints used by relax()
+	ConstraintBatches batches;
+	bool dirty = true;
+	
+	// relax iterations run by the last step, see VerletJS::adaptive
+	int iterations = 0;
+	
+	// skipped by the step while sleeping, see VerletJS::sleep; changed is set by
+	// invalidate() and wakes the composite on the next step
+	bool sleeping = false;
+	bool changed = true;
+	int quietSteps = 0;
+	
+	// counts the edits of constraints through invalidate(), detach() and retarget(),
+	// VerletJS regroups the parallel step when it moves; an endpoint rewritten in
+	// place without one of them leaves the groups stale
+	int revision = 0;
+	
+	// farthest any of its particles moved in the last step, found by VerletJS::bounds
+	float moved = 0;
+	
+	Composite(ParticleStore* store): store(store), first(store->size()) {}
+	
+	// creates an object owned by the composite, released in bulk with it
+	template<typename T, typename... Args>
+	T* make(Args&&... args) {
+		return new (arena.allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+	}
+	
+	// destroys an object of the composite, whether it came from make() or new
+	template<typename T>
+	void destroy(T* object) {
+		if (arena.owns(object))
+			object->~T();
+		else
+			delete object;
+	}
+	
+	int begin() {
+		return first;
+	}
+	
+	int end() {
+		return first + (int)particles.size();
+	}
 	
 	PinConstraint* pin(int index, Vec2 pos) {
-		PinConstraint* pc = new PinConstraint(particles[index], pos);
+		PinConstraint* pc = make<PinConstraint>(particles[index], pos);
 		constraints.push_back(pc);
+		invalidate();
 		return pc;
 	}
 	
 	PinConstraint* pin(int index) {
-		PinConstraint* pc = new PinConstraint(particles[index], particles[index]->pos);
-		constraints.push_back(pc);
-		return pc;
+		return pin(index, particles[index]->getPos());
 	}
 	
-	virtual void drawParticles() {
+	void setRadius(float radius) {
+		int i;
+		for (i=begin(); i<end(); i++)
+			store->radius[i] = radius;
+	}
+	
+	// must be called after constraints are added, removed or modified
+	// once the composite has been stepped
+	void invalidate() {
+		dirty = true;
+		changed = true;
+		revision++;
+	}
+	
+	// removes and destroys a constraint in O(1), false for a stale handle; distance
+	// constraints leave the batches in place, others have them rebuilt
+	bool remove(SlotHandle handle) {
+		Constraint* constraint = detach(handle);
+		if (!constraint)
+			return false;
+		
+		destroy(constraint);
+		return true;
+	}
+	
+	bool remove(Constraint* constraint) {
+		return remove(constraints.handle(constraint->position));
+	}
+	
+	// removes a constraint as remove() does but leaves it to the caller, who may
+	// insert it again or destroy() it; NULL for a stale handle
+	Constraint* detach(SlotHandle handle) {
+		Constraint** slot = constraints.get(handle);
+		if (!slot)
+			return NULL;
+		
+		Constraint* constraint = *slot;
+		if (!dirty && (constraint->type & Constraint::DISTANCE))
+			batches.distances.remove(static_cast<DistanceConstraint*>(constraint)->slot);
+		else
+			dirty = true;
+		changed = true;
+		revision++;
+		
+		constraints.remove(handle);
+		return constraint;
+	}
+	
+	// removes the distance constraints that tore in the last step
+	void removeTorn() {
+		DistanceBatch& d = batches.distances;
+		if (dirty || !d.torn)
+			return;
+		
+		// removal reorders the batch, so collect first
+		vector<DistanceConstraint*> torn;
+		int i;
+		for (i=0; i<d.size(); i++)
+			if (d.limit[i] < 0)
+				torn.push_back(d.constraints[i]);
+		
+		for (i=0; i<torn.size(); i++) {
+			tore(torn[i]);
+			remove(torn[i]);
+		}
+		d.torn = false;
+	}
+	
+	// called before a torn constraint is destroyed
+	virtual void tore(DistanceConstraint* constraint) {
+	}
+	
+	// moves the second end of a distance constraint without rebuilding the batches,
+	// unless they are colored since the new particle may break the coloring
+	void retarget(DistanceConstraint* constraint, Particle* b) {
+		constraint->b = b;
+		revision++;
+		if (dirty || batches.distances.colored())
+			invalidate();
+		else
+			batches.distances.b[constraint->slot] = b->index;
+	}
+	
+	// pool: relax the distance and angle constraints color by color on the pool, NULL for serial
+	virtual void relax(float stepCoef, ThreadPool* pool = NULL) {
+		prepare(pool);
+		batches.relax(*store, stepCoef, pool);
+	}
+	
+	// rebuilds the batches after invalidate() or a change of solver
+	void prepare(ThreadPool* pool) {
+		if (dirty || batches.colored != (pool != NULL)) {
+			batches.build(constraints, pool != NULL);
+			dirty = false;
+		}
+	}
+	
+	// several iterations at once, for composites that can reorder the work across them
+	virtual void relax(float stepCoef, int iterations, ThreadPool* pool) {
+		int i;
+		for (i=0; i<iterations; i++)
+			relax(stepCoef, pool);
+	}
+	
+	// constraints relaxed by one iteration, including those kept outside the list
+	virtual int constraintCount() {
+		return (int)constraints.size();
+	}
+	
+	virtual void drawParticles(Renderer& r) {
 		int i;
 		for (i=0; i<particles.size(); i++)
-			particles[i]->draw();
+			particles[i]->draw(r);
 	}
 	
-	virtual void drawConstraints() {
+	virtual void drawConstraints(Renderer& r) {
 		int i;
 		for (i=0; i<constraints.size(); i++)
-			constraints[i]->draw();
+			constraints[i]->draw(r);
 	}
 	
 	virtual void update(float dt) {
 	}
 	
-	~Composite() {
+	// composite read or written by update(), the parallel scheduler keeps both in one task
+	virtual Composite* dependency() {
+		return NULL;
+	}
+	
+	virtual ~Composite() {
 		int c, p;
 		
 		for (c = 0; c < constraints.size(); c++)
-			delete constraints[c];
+			destroy(constraints[c]);
 		
 		constraints.clear();
 		
 		for (p = 0; p < particles.size(); p++)
-			delete particles[p];
+			destroy(particles[p]);
 		
 		particles.clear();
 	}
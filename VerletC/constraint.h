@@ -25,13 +25,19 @@
 // DistanceConstraint -- constrains to initial distance
 // PinConstraint -- constrains to static/fixed point
 // AngleConstraint -- constrains 3 particles to an angle
+// ConstraintBatches -- the constraints of a composite flattened into per-type arrays
 
 #pragma once
 
 #include "particle.h"
 #include "util.h"
+#include "profiler.h"
+#include "threadpool.h"
+#include "fasttrig.h"
+#include "slotmap.h"
 
 #include <math.h>
+#include <atomic>
 
 struct Constraint {
 	enum Type{
@@ -43,15 +49,242 @@ struct Constraint {
 	
 	Type type;
 	
+	// index in the composite's constraint list, kept by the list as it changes
+	int position = -1;
+	
 	virtual void relax(float stepCoef) = 0;
-	virtual void draw() = 0;
+	virtual void draw(Renderer& r) = 0;
 	
 	Constraint(Type type): type(type) {}
 	
 	virtual ~Constraint() {}
 };
 
-typedef vector<Constraint*> Constraints;
+inline void slotMoved(Constraint*& constraint, int position) {
+	constraint->position = position;
+}
+
+typedef SlotMap<Constraint*> Constraints;
+
+// relaxation kernels, shared by the constraint objects and the batches
+
+inline void relaxDistance(float* x, float* y, int a, int b, float distance, float stiffness, float stepCoef) {
+	float nx = x[a]-x[b];
+	float ny = y[a]-y[b];
+	float m = nx*nx + ny*ny;
+	float coef = ((distance*distance - m)/m)*stiffness*stepCoef;
+	nx *= coef;
+	ny *= coef;
+	x[a] += nx;
+	y[a] += ny;
+	x[b] -= nx;
+	y[b] -= ny;
+}
+
+// relaxDistance unless the constraint is stretched beyond the square root of limit2,
+// true when it tears
+inline bool relaxDistanceTearing(float* x, float* y, int a, int b, float distance, float stiffness, float stepCoef, float limit2) {
+	float nx = x[a]-x[b];
+	float ny = y[a]-y[b];
+	float m = nx*nx + ny*ny;
+	if (m > limit2)
+		return true;
+	float coef = ((distance*distance - m)/m)*stiffness*stepCoef;
+	nx *= coef;
+	ny *= coef;
+	x[a] += nx;
+	y[a] += ny;
+	x[b] -= nx;
+	y[b] -= ny;
+	return false;
+}
+
+// reference implementation of the angle kernel with libm trigonometry
+inline void relaxAngleExact(float* x, float* y, int a, int b, int c, float angle, float stiffness, float stepCoef) {
+	Vec2 pa = Vec2(x[a], y[a]);
+	Vec2 pb = Vec2(x[b], y[b]);
+	Vec2 pc = Vec2(x[c], y[c]);
+	
+	float newAngle = pb.angle2(pa, pc);
+	float diff = newAngle - angle;
+	
+	if (diff <= -M_PI)
+		diff += 2.0f*M_PI;
+	else if (diff >= M_PI)
+		diff -= 2.0f*M_PI;
+	
+	diff *= stepCoef*stiffness;
+	
+	pa = pa.rotate(pb, diff);
+	pc = pc.rotate(pb, -diff);
+	pb = pb.rotate(pa, diff);
+	pb = pb.rotate(pc, -diff);
+	
+	x[a] = pa.x;
+	y[a] = pa.y;
+	x[b] = pb.x;
+	y[b] = pb.y;
+	x[c] = pc.x;
+	y[c] = pc.y;
+}
+
+// the angle kernel used by the solver: one fastAtan2 and one fastSinCos instead of
+// an atan2f and four sinf/cosf pairs. With the bounds of fasttrig.h each particle
+// ends up within 5e-6 of the longest arm of where relaxAngleExact puts it: the
+// angle is off by at most 6e-7 and each of the four rotations by 4.5e-7 of a
+// lever of at most twice the arm (3.2e-6 measured, see test_relaxAngle). Define
+// VERLET_EXACT_TRIG to use relaxAngleExact instead
+inline void relaxAngle(float* x, float* y, int a, int b, int c, float angle, float stiffness, float stepCoef) {
+#ifdef VERLET_EXACT_TRIG
+	relaxAngleExact(x, y, a, b, c, angle, stiffness, stepCoef);
+#else
+	float bx = x[b];
+	float by = y[b];
+	float ux = x[a]-bx;
+	float uy = y[a]-by;
+	float vx = x[c]-bx;
+	float vy = y[c]-by;
+	
+	// Vec2::angle2 of a and c around b
+	float diff = fastAtan2(ux*vy - uy*vx, ux*vx + uy*vy) - angle;
+	
+	const float pi = 3.14159265359f;
+	if (diff <= -pi)
+		diff += 2.0f*pi;
+	else if (diff >= pi)
+		diff -= 2.0f*pi;
+	
+	diff *= stepCoef*stiffness;
+	
+	float sn, cs;
+	fastSinCos(diff, sn, cs);
+	
+	// a around b by diff, c around b by -diff
+	float ax = ux*cs - uy*sn + bx;
+	float ay = ux*sn + uy*cs + by;
+	float cx = vx*cs + vy*sn + bx;
+	float cy = vy*cs - vx*sn + by;
+	
+	// b around the new a by diff, then around the new c by -diff
+	float dx = bx-ax;
+	float dy = by-ay;
+	bx = dx*cs - dy*sn + ax;
+	by = dx*sn + dy*cs + ay;
+	dx = bx-cx;
+	dy = by-cy;
+	bx = dx*cs + dy*sn + cx;
+	by = dy*cs - dx*sn + cy;
+	
+	x[a] = ax;
+	y[a] = ay;
+	x[b] = bx;
+	y[b] = by;
+	x[c] = cx;
+	y[c] = cy;
+#endif
+}
+
+#if defined(__AVX2__)
+
+// relaxAngle for eight constraints at a time, which must not share particles;
+// returns where the scalar loop has to continue
+inline int relaxAngleAVX2(float* x, float* y, const int* a, const int* b, const int* c, const float* angle, const float* stiffness, float stepCoef, int begin, int end) {
+	const __m256 pi = _mm256_set1_ps(3.14159265359f);
+	const __m256 twoPi = _mm256_set1_ps(2.0f*3.14159265359f);
+	const __m256 coef = _mm256_set1_ps(stepCoef);
+	
+	int i, k;
+	for (i=begin; i+8<=end; i+=8) {
+		__m256i ia = _mm256_loadu_si256((const __m256i*)(a+i));
+		__m256i ib = _mm256_loadu_si256((const __m256i*)(b+i));
+		__m256i ic = _mm256_loadu_si256((const __m256i*)(c+i));
+		
+		__m256 bx = _mm256_i32gather_ps(x, ib, 4);
+		__m256 by = _mm256_i32gather_ps(y, ib, 4);
+		__m256 ux = _mm256_sub_ps(_mm256_i32gather_ps(x, ia, 4), bx);
+		__m256 uy = _mm256_sub_ps(_mm256_i32gather_ps(y, ia, 4), by);
+		__m256 vx = _mm256_sub_ps(_mm256_i32gather_ps(x, ic, 4), bx);
+		__m256 vy = _mm256_sub_ps(_mm256_i32gather_ps(y, ic, 4), by);
+		
+		__m256 cross = _mm256_sub_ps(_mm256_mul_ps(ux, vy), _mm256_mul_ps(uy, vx));
+		__m256 dot = _mm256_add_ps(_mm256_mul_ps(ux, vx), _mm256_mul_ps(uy, vy));
+		__m256 diff = _mm256_sub_ps(fastAtan2(cross, dot), _mm256_loadu_ps(angle+i));
+		
+		// both masks from the unwrapped difference, as the else in relaxAngle
+		__m256 below = _mm256_cmp_ps(diff, _mm256_sub_ps(_mm256_setzero_ps(), pi), _CMP_LE_OQ);
+		__m256 above = _mm256_andnot_ps(below, _mm256_cmp_ps(diff, pi, _CMP_GE_OQ));
+		diff = _mm256_add_ps(diff, _mm256_and_ps(below, twoPi));
+		diff = _mm256_sub_ps(diff, _mm256_and_ps(above, twoPi));
+		diff = _mm256_mul_ps(diff, _mm256_mul_ps(coef, _mm256_loadu_ps(stiffness+i)));
+		
+		__m256 sn, cs;
+		fastSinCos(diff, sn, cs);
+		
+		__m256 ax = _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(ux, cs), _mm256_mul_ps(uy, sn)), bx);
+		__m256 ay = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ux, sn), _mm256_mul_ps(uy, cs)), by);
+		__m256 cx = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vx, cs), _mm256_mul_ps(vy, sn)), bx);
+		__m256 cy = _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(vy, cs), _mm256_mul_ps(vx, sn)), by);
+		
+		__m256 dx = _mm256_sub_ps(bx, ax);
+		__m256 dy = _mm256_sub_ps(by, ay);
+		bx = _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(dx, cs), _mm256_mul_ps(dy, sn)), ax);
+		by = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, sn), _mm256_mul_ps(dy, cs)), ay);
+		dx = _mm256_sub_ps(bx, cx);
+		dy = _mm256_sub_ps(by, cy);
+		bx = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, cs), _mm256_mul_ps(dy, sn)), cx);
+		by = _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(dy, cs), _mm256_mul_ps(dx, sn)), cy);
+		
+		// no scatter in AVX2
+		float out[6][8];
+		_mm256_storeu_ps(out[0], ax);
+		_mm256_storeu_ps(out[1], ay);
+		_mm256_storeu_ps(out[2], bx);
+		_mm256_storeu_ps(out[3], by);
+		_mm256_storeu_ps(out[4], cx);
+		_mm256_storeu_ps(out[5], cy);
+		for (k=0; k<8; k++) {
+			x[a[i+k]] = out[0][k];
+			y[a[i+k]] = out[1][k];
+			x[b[i+k]] = out[2][k];
+			y[b[i+k]] = out[3][k];
+			x[c[i+k]] = out[4][k];
+			y[c[i+k]] = out[5][k];
+		}
+	}
+	return i;
+}
+
+#endif
+
+// relaxAngle against relaxAngleExact over angles, arm lengths and step sizes,
+// errors relative to the longest arm; b sits at the origin so that the rounding
+// of large coordinates, common to both kernels, does not hide the difference
+void test_relaxAngle() {
+	float worst = 0;
+	int i, j;
+	for (i=0; i<20000; i++) {
+		float t0 = -M_PI + 2*M_PI*((i*7919)%20000)/20000.0f;
+		float t1 = -M_PI + 2*M_PI*i/20000.0f;
+		float r0 = 1 + (i%13)*7.5f;
+		float r1 = 1 + (i%17)*11.0f;
+		float rest = -M_PI + 2*M_PI*((i*104729)%20000)/20000.0f;
+		float coef = 1.0f/(1 + i%16);
+		
+		float x[2][3] = {{r0*cosf(t0), 0, r1*cosf(t1)}};
+		float y[2][3] = {{r0*sinf(t0), 0, r1*sinf(t1)}};
+		for (j=0; j<3; j++) {
+			x[1][j] = x[0][j];
+			y[1][j] = y[0][j];
+		}
+		
+		relaxAngle(x[0], y[0], 0, 1, 2, rest, 1.0f, coef);
+		relaxAngleExact(x[1], y[1], 0, 1, 2, rest, 1.0f, coef);
+		for (j=0; j<3; j++)
+			worst = fmaxf(worst, hypotf(x[0][j]-x[1][j], y[0][j]-y[1][j])/fmaxf(r0, r1));
+	}
+	
+	cout << "relaxAngle: " << (worst <= 5e-6f ? "PASS" : "FAIL") << " max error " << worst << " of the arm length\n";
+}
 
 struct DistanceConstraint : public Constraint {
 	Particle* a;
@@ -59,9 +292,16 @@ struct DistanceConstraint : public Constraint {
 	float distance;
 	float stiffness;
 	
+	// position in the composite's DistanceBatch, set when the batches are built
+	int slot = -1;
+	
+	// tears once stretched beyond tear times its distance, never when 0;
+	// see VerletJS::finishStep
+	float tear = 0;
+	
 	DistanceConstraint(Particle* a, Particle* b, float stiffness)
 	: Constraint(DISTANCE), a(a), b(b), stiffness(stiffness) {
-		distance = (a->pos-b->pos).length();
+		distance = (a->getPos()-b->getPos()).length();
 	}
 	
 	DistanceConstraint(Particle* a, Particle* b, float stiffness, float distance)
@@ -69,17 +309,11 @@ struct DistanceConstraint : public Constraint {
 	}
 	
 	void relax(float stepCoef) {
-		Vec2 normal = a->pos-b->pos;
-		float m = normal.length2();
-		normal *= ((distance*distance - m)/m)*stiffness*stepCoef;
-		a->pos += normal;
-		b->pos -= normal;
+		relaxDistance(a->store->x.data(), a->store->y.data(), a->index, b->index, distance, stiffness, stepCoef);
 	}
 	
-	void draw() {
-		glLineWidth(1.5);
-		glColor3ub(216, 221, 226);
-		drawLine(a->pos, b->pos);
+	void draw(Renderer& r) {
+		r.line(a->getPos(), b->getPos(), 1.5, Color(216, 221, 226));
 	}
 	
 	~DistanceConstraint() {}
@@ -89,10 +323,12 @@ struct PinConstraint : public Constraint, public Draggable {
 	Vec2 pos;
 	Particle* a;
 	
-	PinConstraint(Particle* a, Vec2 pos): Constraint(PIN), pos(pos), a(a) {}
+	PinConstraint(Particle* a, Vec2 pos): Constraint(PIN), pos(pos), a(a) {
+		a->store->pins[a->index] = this;
+	}
 	
 	void relax(float stepCoef) {
-		a->pos = pos;
+		a->setPos(pos);
 	}
 	
 	Vec2 getPos() {
@@ -103,20 +339,14 @@ struct PinConstraint : public Constraint, public Draggable {
 		pos = p;
 	}
 	
-	void draw() {
-		glLineWidth(1.5);
-		glColor4ub(0,153,255,26);
-		
-		glEnable(GL_BLEND);
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-		
-		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-		drawCircle(pos, 6.0f);
-		
-		glDisable(GL_BLEND);
+	void draw(Renderer& r) {
+		r.circle(pos, 6.0f, Color(0,153,255,26));
 	}
 	
-	~PinConstraint() {}
+	~PinConstraint() {
+		if (a->store->pins[a->index] == this)
+			a->store->pins[a->index] = NULL;
+	}
 };
 
 struct AngleConstraint : public Constraint {
@@ -127,46 +357,462 @@ struct AngleConstraint : public Constraint {
 	float stiffness;
 	
 	AngleConstraint(Particle* a, Particle* b, Particle* c, float stiffness): Constraint(ANGLE), a(a), b(b), c(c), stiffness(stiffness) {
-		angle = b->pos.angle2(a->pos, c->pos);
+		angle = b->getPos().angle2(a->getPos(), c->getPos());
+	}
+	
+	AngleConstraint(Particle* a, Particle* b, Particle* c, float stiffness, float angle): Constraint(ANGLE), a(a), b(b), c(c), angle(angle), stiffness(stiffness) {
 	}
 	
 	void relax(float stepCoef) {
-		float newAngle = b->pos.angle2(a->pos, c->pos);
-		float diff = newAngle - angle;
+		relaxAngle(a->store->x.data(), a->store->y.data(), a->index, b->index, c->index, angle, stiffness, stepCoef);
+	}
+	
+	void draw(Renderer& r) {
+		r.line(b->getPos(), a->getPos(), 5, Color(255,255,0,51));
+		r.line(b->getPos(), c->getPos(), 5, Color(255,255,0,51));
+	}
+	
+	~AngleConstraint() {}
+};
+
+// greedy graph coloring of constraints whose particles are given by numEnds
+// index arrays: order lists the constraints grouped by color, constraints in
+// [colors[k], colors[k+1]) of it share no particle, the ones from colors.back()
+// on could not be colored
+inline void colorConstraints(const vector<int>** ends, int numEnds, vector<int>& order, vector<int>& colors) {
+	int i, e, n = (int)ends[0]->size();
+	order.clear();
+	colors.clear();
+	if (n == 0)
+		return;
+	
+	int lo = (*ends[0])[0], hi = lo;
+	for (e=0; e<numEnds; e++) {
+		for (i=0; i<n; i++) {
+			lo = min(lo, (*ends[e])[i]);
+			hi = max(hi, (*ends[e])[i]);
+		}
+	}
+	
+	// colors already used by the constraints touching each particle
+	vector<unsigned long long> used(hi-lo+1, 0);
+	
+	const int maxColors = 64;
+	vector<int> color(n);
+	vector<int> count(maxColors+1, 0);
+	for (i=0; i<n; i++) {
+		unsigned long long mask = 0;
+		for (e=0; e<numEnds; e++)
+			mask |= used[(*ends[e])[i]-lo];
+		
+		int c = 0;
+		while (c < maxColors && (mask & (1ULL << c)))
+			c++;
+		
+		if (c < maxColors) {
+			for (e=0; e<numEnds; e++)
+				used[(*ends[e])[i]-lo] |= 1ULL << c;
+		}
+		
+		color[i] = c;
+		count[c]++;
+	}
+	
+	int numColors = 0;
+	for (i=0; i<maxColors; i++)
+		if (count[i])
+			numColors = i+1;
+	
+	// stable counting sort by color, uncolorable constraints go last
+	vector<int> offset(maxColors+2, 0);
+	for (i=0; i<=maxColors; i++)
+		offset[i+1] = offset[i] + count[i];
+	
+	colors.assign(offset.begin(), offset.begin()+numColors+1);
+	colors.back() = offset[maxColors];
+	
+	order.resize(n);
+	for (i=0; i<n; i++)
+		order[offset[color[i]]++] = i;
+}
+
+struct DistanceBatch {
+	vector<int> a;
+	vector<int> b;
+	vector<float> distance;
+	vector<float> stiffness;
+	vector<DistanceConstraint*> constraints;
+	
+	// squared length at which each constraint tears, infinite if it does not and
+	// negative once it tore; the torn ones stop relaxing until they are removed
+	vector<float> limit;
+	bool tearing = false;
+	atomic<bool> torn{false};
+	
+	// filled by color(): constraints in [colors[k], colors[k+1]) share no particle
+	// and may be relaxed concurrently, the ones from colors.back() on are relaxed serially
+	vector<int> colors;
+	
+	void add(DistanceConstraint* constraint) {
+		constraint->slot = size();
+		constraints.push_back(constraint);
+		a.push_back(constraint->a->index);
+		b.push_back(constraint->b->index);
+		distance.push_back(constraint->distance);
+		stiffness.push_back(constraint->stiffness);
+		float length = constraint->tear*constraint->distance;
+		limit.push_back(constraint->tear > 0 ? length*length : INFINITY);
+		tearing |= constraint->tear > 0;
+	}
+	
+	void clear() {
+		a.clear();
+		b.clear();
+		distance.clear();
+		stiffness.clear();
+		constraints.clear();
+		limit.clear();
+		colors.clear();
+		tearing = false;
+		torn = false;
+	}
+	
+	void move(int from, int to) {
+		// from may be a stale copy left by an earlier move
+		if (from == to)
+			return;
+		a[to] = a[from];
+		b[to] = b[from];
+		distance[to] = distance[from];
+		stiffness[to] = stiffness[from];
+		limit[to] = limit[from];
+		constraints[to] = constraints[from];
+		constraints[to]->slot = to;
+	}
+	
+	// swap-remove; when colored, the hole moves to the end of its color and on
+	// from color to color, taking the last constraint of each
+	void remove(int i) {
+		int k;
+		for (k=1; k<colors.size(); k++) {
+			if (colors[k] <= i)
+				continue;
+			move(colors[k]-1, i);
+			i = --colors[k];
+		}
+		move(size()-1, i);
 		
-		if (diff <= -M_PI)
-			diff += 2.0f*M_PI;
-		else if (diff >= M_PI)
-			diff -= 2.0f*M_PI;
+		a.pop_back();
+		b.pop_back();
+		distance.pop_back();
+		stiffness.pop_back();
+		limit.pop_back();
+		constraints.pop_back();
+	}
+	
+	int size() {
+		return (int)a.size();
+	}
+	
+	bool colored() {
+		return !colors.empty();
+	}
+	
+	// reorders the constraints grouped by color
+	void color() {
+		vector<int> order;
+		const vector<int>* ends[2] = {&a, &b};
+		colorConstraints(ends, 2, order, colors);
 		
-		diff *= stepCoef*stiffness;
+		DistanceBatch sorted;
+		int i;
+		for (i=0; i<order.size(); i++) {
+			sorted.a.push_back(a[order[i]]);
+			sorted.b.push_back(b[order[i]]);
+			sorted.distance.push_back(distance[order[i]]);
+			sorted.stiffness.push_back(stiffness[order[i]]);
+			sorted.limit.push_back(limit[order[i]]);
+			sorted.constraints.push_back(constraints[order[i]]);
+			sorted.constraints[i]->slot = i;
+		}
 		
-		a->pos = a->pos.rotate(b->pos, diff);
-		c->pos = c->pos.rotate(b->pos, -diff);
-		b->pos = b->pos.rotate(a->pos, diff);
-		b->pos = b->pos.rotate(c->pos, -diff);
+		a.swap(sorted.a);
+		b.swap(sorted.b);
+		distance.swap(sorted.distance);
+		stiffness.swap(sorted.stiffness);
+		limit.swap(sorted.limit);
+		constraints.swap(sorted.constraints);
 	}
 	
-	void draw() {
-		glColor4ub(255,255,0,51);
-		glLineWidth(5);
+	void relax(float* x, float* y, float stepCoef, int begin, int end) {
+		int i;
+		if (!tearing) {
+			for (i=begin; i<end; i++)
+				relaxDistance(x, y, a[i], b[i], distance[i], stiffness[i], stepCoef);
+			return;
+		}
 		
-		glEnable(GL_BLEND);
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		for (i=begin; i<end; i++) {
+			if (relaxDistanceTearing(x, y, a[i], b[i], distance[i], stiffness[i], stepCoef, limit[i])) {
+				limit[i] = -1;
+				stiffness[i] = 0;
+				torn.store(true, memory_order_relaxed);
+			}
+		}
+	}
+	
+	void relax(float* x, float* y, float stepCoef, ThreadPool* pool = NULL) {
+		if (!pool || !colored()) {
+			relax(x, y, stepCoef, 0, size());
+			return;
+		}
 		
-		glBegin(GL_LINES);
-		{
-			glVertex2f(b->pos.x, b->pos.y);
-			glVertex2f(a->pos.x, a->pos.y);
-			glVertex2f(b->pos.x, b->pos.y);
-			glVertex2f(c->pos.x, c->pos.y);
-			
-		}glEnd();
+		const int grain = 2048;
+		int k;
+		for (k=0; k+1<colors.size(); k++) {
+			pool->parallelFor(colors[k], colors[k+1], grain, [this, x, y, stepCoef](int begin, int end) {
+				relax(x, y, stepCoef, begin, end);
+			});
+		}
+		relax(x, y, stepCoef, colors.back(), size());
+	}
+};
+
+struct AngleBatch {
+	vector<int> a;
+	vector<int> b;
+	vector<int> c;
+	vector<float> angle;
+	vector<float> stiffness;
+	
+	// filled by color(), as in DistanceBatch
+	vector<int> colors;
+	
+	void add(AngleConstraint* constraint) {
+		a.push_back(constraint->a->index);
+		b.push_back(constraint->b->index);
+		c.push_back(constraint->c->index);
+		angle.push_back(constraint->angle);
+		stiffness.push_back(constraint->stiffness);
+	}
+	
+	void clear() {
+		a.clear();
+		b.clear();
+		c.clear();
+		angle.clear();
+		stiffness.clear();
+		colors.clear();
+	}
+	
+	int size() {
+		return (int)a.size();
+	}
+	
+	bool colored() {
+		return !colors.empty();
+	}
+	
+	// reorders the constraints grouped by color
+	void color() {
+		vector<int> order;
+		const vector<int>* ends[3] = {&a, &b, &c};
+		colorConstraints(ends, 3, order, colors);
 		
-		glLineWidth(1);
+		AngleBatch sorted;
+		int i;
+		for (i=0; i<order.size(); i++) {
+			sorted.a.push_back(a[order[i]]);
+			sorted.b.push_back(b[order[i]]);
+			sorted.c.push_back(c[order[i]]);
+			sorted.angle.push_back(angle[order[i]]);
+			sorted.stiffness.push_back(stiffness[order[i]]);
+		}
 		
-		glDisable(GL_BLEND);
+		a.swap(sorted.a);
+		b.swap(sorted.b);
+		c.swap(sorted.c);
+		angle.swap(sorted.angle);
+		stiffness.swap(sorted.stiffness);
 	}
 	
-	~AngleConstraint() {}
+	// independent: the constraints in [begin, end) share no particle
+	void relax(float* x, float* y, float stepCoef, int begin, int end, bool independent) {
+		int i = begin;
+#if defined(__AVX2__) && !defined(VERLET_EXACT_TRIG)
+		if (independent)
+			i = relaxAngleAVX2(x, y, a.data(), b.data(), c.data(), angle.data(), stiffness.data(), stepCoef, begin, end);
+#endif
+		for (; i<end; i++)
+			relaxAngle(x, y, a[i], b[i], c[i], angle[i], stiffness[i], stepCoef);
+	}
+	
+	// colored batches relax color by color, eight constraints at a time with AVX2
+	// and on the pool if there is one
+	void relax(float* x, float* y, float stepCoef, ThreadPool* pool = NULL) {
+		if (!colored()) {
+			relax(x, y, stepCoef, 0, size(), false);
+			return;
+		}
+		
+		const int grain = 1024;
+		int k;
+		for (k=0; k+1<colors.size(); k++) {
+			if (pool) {
+				pool->parallelFor(colors[k], colors[k+1], grain, [this, x, y, stepCoef](int begin, int end) {
+					relax(x, y, stepCoef, begin, end, true);
+				});
+			} else {
+				relax(x, y, stepCoef, colors[k], colors[k+1], true);
+			}
+		}
+		relax(x, y, stepCoef, colors.back(), size(), false);
+	}
+};
+
+struct PinBatch {
+	vector<int> a;
+	
+	// pin positions are read back from the constraints since they move while dragged
+	vector<PinConstraint*> pins;
+	
+	void add(PinConstraint* constraint) {
+		a.push_back(constraint->a->index);
+		pins.push_back(constraint);
+	}
+	
+	void clear() {
+		a.clear();
+		pins.clear();
+	}
+	
+	int size() {
+		return (int)a.size();
+	}
+	
+	void relax(float* x, float* y) {
+		int i, n = size();
+		for (i=0; i<n; i++) {
+			x[a[i]] = pins[i]->pos.x;
+			y[a[i]] = pins[i]->pos.y;
+		}
+	}
+};
+
+// removing from a colored DistanceBatch keeps every color free of shared particles
+// and every constraint's slot in step
+void test_DistanceBatch() {
+	ParticleStore store;
+	vector<Particle*> particles;
+	vector<DistanceConstraint*> constraints;
+	const int n = 400;
+	int i, k;
+	for (i=0; i<n; i++)
+		particles.push_back(new Particle(&store, Vec2(i%20, i/20)));
+	for (i=0; i<n; i++) {
+		if (i%20 > 0)
+			constraints.push_back(new DistanceConstraint(particles[i], particles[i-1], 1));
+		if (i >= 20)
+			constraints.push_back(new DistanceConstraint(particles[i], particles[i-20], 1));
+	}
+	
+	DistanceBatch batch;
+	for (i=0; i<constraints.size(); i++)
+		batch.add(constraints[i]);
+	batch.color();
+	
+	// every third constraint, in an order unrelated to the slots
+	bool ok = true;
+	int j, removed = 0;
+	for (i=0; i<constraints.size(); i++) {
+		DistanceConstraint* constraint = constraints[(i*7)%constraints.size()];
+		if ((i*7)%constraints.size()%3 == 0) {
+			batch.remove(constraint->slot);
+			removed++;
+			for (j=0; j<batch.size(); j++)
+				ok &= batch.constraints[j]->slot == j;
+		}
+	}
+	
+	ok &= batch.size() == constraints.size()-removed;
+	for (i=0; i<batch.size(); i++)
+		ok &= batch.a[i] == batch.constraints[i]->a->index && batch.b[i] == batch.constraints[i]->b->index;
+	for (k=0; k+1<batch.colors.size(); k++) {
+		vector<bool> used(n, false);
+		for (i=batch.colors[k]; i<batch.colors[k+1]; i++) {
+			ok &= !used[batch.a[i]] && !used[batch.b[i]];
+			used[batch.a[i]] = used[batch.b[i]] = true;
+		}
+	}
+	
+	cout << "DistanceBatch(remove): " << (ok ? "PASS" : "FAIL") << "\n";
+	
+	for (i=0; i<constraints.size(); i++)
+		delete constraints[i];
+	for (i=0; i<n; i++)
+		delete particles[i];
+}
+
+struct ConstraintBatches {
+	DistanceBatch distances;
+	AngleBatch angles;
+	PinBatch pins;
+	
+	// constraints of unknown type fall back to virtual dispatch
+	vector<Constraint*> others;
+	
+	// distances and angles grouped by color for the parallel solver
+	bool colored = false;
+	
+	// colored: group the distance and angle constraints for the parallel solver
+	void build(Constraints& constraints, bool colored = false) {
+		this->colored = colored;
+		distances.clear();
+		angles.clear();
+		pins.clear();
+		others.clear();
+		
+		int i;
+		for (i=0; i<constraints.size(); i++) {
+			Constraint* constraint = constraints[i];
+			if (constraint->type & Constraint::DISTANCE)
+				distances.add(static_cast<DistanceConstraint*>(constraint));
+			else if (constraint->type & Constraint::ANGLE)
+				angles.add(static_cast<AngleConstraint*>(constraint));
+			else if (constraint->type & Constraint::PIN)
+				pins.add(static_cast<PinConstraint*>(constraint));
+			else
+				others.push_back(constraint);
+		}
+		
+		if (colored) {
+			distances.color();
+			angles.color();
+		}
+	}
+	
+	// one iteration, pins go last so that pinned particles end up exactly in place
+	void relax(ParticleStore& store, float stepCoef, ThreadPool* pool = NULL) {
+		float* x = store.x.data();
+		float* y = store.y.data();
+		
+		{
+			PROFILE_SCOPE(PROFILE_RELAX_DISTANCE);
+			distances.relax(x, y, stepCoef, pool);
+		}
+		{
+			PROFILE_SCOPE(PROFILE_RELAX_ANGLE);
+			angles.relax(x, y, stepCoef, pool);
+		}
+		{
+			PROFILE_SCOPE(PROFILE_RELAX_OTHER);
+			int i;
+			for (i=0; i<others.size(); i++)
+				others[i]->relax(stepCoef);
+		}
+		{
+			PROFILE_SCOPE(PROFILE_RELAX_PIN);
+			pins.relax(x, y);
+		}
+	}
 };
@@ -0,0 +1,125 @@
+// Handoff -- lock-free ways to pass data between two threads, for a simulation
+// that runs on its own thread:
+//
+//	TripleBuffer   the producer publishes whole frames, the consumer always
+//	               takes the newest one; neither ever waits for the other
+//	SpscQueue      a bounded ring of events from one producer to one consumer
+
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <iostream>
+
+using namespace std;
+
+template<typename T>
+struct TripleBuffer {
+	T buffers[3];
+	
+	// index of the buffer between the two threads, with fresh set while it holds
+	// a frame the consumer has not taken yet
+	static const int fresh = 4;
+	atomic<int> middle{1};
+	
+	// owned by the producer and by the consumer
+	int back = 0;
+	int front = 2;
+	
+	// the frame being written by the producer
+	T& write() {
+		return buffers[back];
+	}
+	
+	// hands the written frame over, the producer goes on with the older one
+	void publish() {
+		back = middle.exchange(back | fresh, memory_order_acq_rel) & 3;
+	}
+	
+	// takes the newest published frame, false when there is none since the last call
+	bool acquire() {
+		if (!(middle.load(memory_order_acquire) & fresh))
+			return false;
+		front = middle.exchange(front, memory_order_acq_rel) & 3;
+		return true;
+	}
+	
+	// the frame taken by the last acquire(), left alone by the producer
+	T& read() {
+		return buffers[front];
+	}
+};
+
+template<typename T, int Capacity>
+struct SpscQueue {
+	T items[Capacity];
+	
+	// items are pushed at tail and popped at head, both only grow
+	atomic<unsigned> head{0};
+	atomic<unsigned> tail{0};
+	
+	// false when full, the item is dropped
+	bool push(const T& item) {
+		unsigned t = tail.load(memory_order_relaxed);
+		if (t - head.load(memory_order_acquire) >= Capacity)
+			return false;
+		items[t % Capacity] = item;
+		tail.store(t+1, memory_order_release);
+		return true;
+	}
+	
+	// false when empty
+	bool pop(T& item) {
+		unsigned h = head.load(memory_order_relaxed);
+		if (h == tail.load(memory_order_acquire))
+			return false;
+		item = items[h % Capacity];
+		head.store(h+1, memory_order_release);
+		return true;
+	}
+};
+
+// a producer and a consumer thread: frames arrive whole and in order, events all
+// arrive in order
+void test_Handoff() {
+	const int count = 200000;
+	
+	struct Frame {
+		int values[64];
+	};
+	TripleBuffer<Frame> frames;
+	SpscQueue<int, 64> events;
+	
+	thread producer([&]() {
+		int i, j;
+		for (i=1; i<=count; i++) {
+			Frame& f = frames.write();
+			for (j=0; j<64; j++)
+				f.values[j] = i;
+			frames.publish();
+			
+			while (!events.push(i))
+				this_thread::yield();
+		}
+	});
+	
+	bool whole = true, ordered = true;
+	int last = 0, expected = 1, received = 0, j;
+	while (expected <= count) {
+		if (frames.acquire()) {
+			Frame& f = frames.read();
+			for (j=1; j<64; j++)
+				whole &= f.values[j] == f.values[0];
+			ordered &= f.values[0] > last;
+			last = f.values[0];
+			received++;
+		}
+		
+		int event;
+		while (events.pop(event))
+			ordered &= event == expected++;
+	}
+	producer.join();
+	
+	cout << "Handoff: " << (whole && ordered ? "PASS" : "FAIL") << " " << received << " of " << count << " frames taken\n";
+}
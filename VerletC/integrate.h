@@ -0,0 +1,128 @@
+// Integration -- inertia, gravity and friction for a range of the particle store.
+// Runs 8 particles at a time with AVX, 4 with SSE2, and the remainder through
+// the scalar loop, which uses the same branchless formulation so that every
+// path produces the same results.
+
+#pragma once
+
+#if defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+struct IntegrateParams {
+	float friction;
+	float groundFriction;
+	
+	// y coordinate from which particles are considered on the ground
+	float ground;
+	
+	// gravity displacement for this step
+	float gx;
+	float gy;
+};
+
+inline void integrateScalar(float* x, float* y, float* lastX, float* lastY, int begin, int end, const IntegrateParams& p) {
+	int i;
+	for (i=begin; i<end; i++) {
+		// calculate velocity
+		float vx = (x[i]-lastX[i])*p.friction;
+		float vy = (y[i]-lastY[i])*p.friction;
+		
+		// ground friction, (v/|v|)*|v|*groundFriction reduces to v*groundFriction
+		float m2 = vx*vx + vy*vy;
+		float f = (y[i] >= p.ground && m2 > 0.000001f) ? p.groundFriction : 1.0f;
+		vx *= f;
+		vy *= f;
+		
+		// save last good state
+		lastX[i] = x[i];
+		lastY[i] = y[i];
+		
+		// gravity and inertia
+		x[i] = x[i] + p.gx + vx;
+		y[i] = y[i] + p.gy + vy;
+	}
+}
+
+#if defined(__AVX__)
+
+inline int integrateAVX(float* x, float* y, float* lastX, float* lastY, int begin, int end, const IntegrateParams& p) {
+	__m256 friction = _mm256_set1_ps(p.friction);
+	__m256 groundFriction = _mm256_set1_ps(p.groundFriction);
+	__m256 ground = _mm256_set1_ps(p.ground);
+	__m256 epsilon = _mm256_set1_ps(0.000001f);
+	__m256 one = _mm256_set1_ps(1.0f);
+	__m256 gx = _mm256_set1_ps(p.gx);
+	__m256 gy = _mm256_set1_ps(p.gy);
+	
+	int i;
+	for (i=begin; i+8<=end; i+=8) {
+		__m256 px = _mm256_loadu_ps(x+i);
+		__m256 py = _mm256_loadu_ps(y+i);
+		
+		__m256 vx = _mm256_mul_ps(_mm256_sub_ps(px, _mm256_loadu_ps(lastX+i)), friction);
+		__m256 vy = _mm256_mul_ps(_mm256_sub_ps(py, _mm256_loadu_ps(lastY+i)), friction);
+		
+		__m256 m2 = _mm256_add_ps(_mm256_mul_ps(vx, vx), _mm256_mul_ps(vy, vy));
+		__m256 onGround = _mm256_and_ps(_mm256_cmp_ps(py, ground, _CMP_GE_OQ), _mm256_cmp_ps(m2, epsilon, _CMP_GT_OQ));
+		__m256 f = _mm256_blendv_ps(one, groundFriction, onGround);
+		vx = _mm256_mul_ps(vx, f);
+		vy = _mm256_mul_ps(vy, f);
+		
+		_mm256_storeu_ps(lastX+i, px);
+		_mm256_storeu_ps(lastY+i, py);
+		
+		_mm256_storeu_ps(x+i, _mm256_add_ps(_mm256_add_ps(px, gx), vx));
+		_mm256_storeu_ps(y+i, _mm256_add_ps(_mm256_add_ps(py, gy), vy));
+	}
+	return i;
+}
+
+#endif
+
+#if defined(__SSE2__)
+
+inline int integrateSSE2(float* x, float* y, float* lastX, float* lastY, int begin, int end, const IntegrateParams& p) {
+	__m128 friction = _mm_set1_ps(p.friction);
+	__m128 groundFriction = _mm_set1_ps(p.groundFriction);
+	__m128 ground = _mm_set1_ps(p.ground);
+	__m128 epsilon = _mm_set1_ps(0.000001f);
+	__m128 one = _mm_set1_ps(1.0f);
+	__m128 gx = _mm_set1_ps(p.gx);
+	__m128 gy = _mm_set1_ps(p.gy);
+	
+	int i;
+	for (i=begin; i+4<=end; i+=4) {
+		__m128 px = _mm_loadu_ps(x+i);
+		__m128 py = _mm_loadu_ps(y+i);
+		
+		__m128 vx = _mm_mul_ps(_mm_sub_ps(px, _mm_loadu_ps(lastX+i)), friction);
+		__m128 vy = _mm_mul_ps(_mm_sub_ps(py, _mm_loadu_ps(lastY+i)), friction);
+		
+		__m128 m2 = _mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy));
+		__m128 onGround = _mm_and_ps(_mm_cmpge_ps(py, ground), _mm_cmpgt_ps(m2, epsilon));
+		__m128 f = _mm_or_ps(_mm_and_ps(onGround, groundFriction), _mm_andnot_ps(onGround, one));
+		vx = _mm_mul_ps(vx, f);
+		vy = _mm_mul_ps(vy, f);
+		
+		_mm_storeu_ps(lastX+i, px);
+		_mm_storeu_ps(lastY+i, py);
+		
+		_mm_storeu_ps(x+i, _mm_add_ps(_mm_add_ps(px, gx), vx));
+		_mm_storeu_ps(y+i, _mm_add_ps(_mm_add_ps(py, gy), vy));
+	}
+	return i;
+}
+
+#endif
+
+inline void integrateParticles(float* x, float* y, float* lastX, float* lastY, int begin, int end, const IntegrateParams& p) {
+	int i = begin;
+#if defined(__AVX__)
+	i = integrateAVX(x, y, lastX, lastY, i, end, p);
+#endif
+#if defined(__SSE2__)
+	i = integrateSSE2(x, y, lastX, lastY, i, end, p);
+#endif
+	integrateScalar(x, y, lastX, lastY, i, end, p);
+}
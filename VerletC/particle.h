@@ -23,10 +23,12 @@
  */
 
 // Particle -- just a point in space that responds to gravity.
+// ParticleStore -- world-level structure-of-arrays holding the state of every particle.
 
 #pragma once
 
 #include "vec2.h"
+#include "render.h"
 
 #include <vector>
 
@@ -35,28 +37,81 @@ using namespace std;
 struct Draggable {
 	virtual Vec2 getPos() = 0;
 	virtual void setPos(Vec2 p) = 0;
+	
+	virtual ~Draggable() {}
 };
 
+struct ParticleStore {
+	vector<float> x;
+	vector<float> y;
+	vector<float> lastX;
+	vector<float> lastY;
+	
+	// collision radius, 0 for particles that do not collide
+	vector<float> radius;
+	
+	// handle of each particle and the pin holding it if any, used for picking
+	vector<Draggable*> handles;
+	vector<Draggable*> pins;
+	
+	int add(Vec2 pos, Draggable* handle = NULL) {
+		x.push_back(pos.x);
+		y.push_back(pos.y);
+		lastX.push_back(pos.x);
+		lastY.push_back(pos.y);
+		radius.push_back(0);
+		handles.push_back(handle);
+		pins.push_back(NULL);
+		return (int)x.size()-1;
+	}
+	
+	void reserve(int n) {
+		x.reserve(n);
+		y.reserve(n);
+		lastX.reserve(n);
+		lastY.reserve(n);
+		radius.reserve(n);
+		handles.reserve(n);
+		pins.reserve(n);
+	}
+	
+	int size() {
+		return (int)x.size();
+	}
+};
+
+// a handle to one entry of the store, used by the builders in Objects/
 struct Particle : public Draggable {
-	Vec2 pos;
-	Vec2 lastPos;
+	ParticleStore* store;
+	int index;
 	
-	Particle(Vec2 pos): pos(pos), lastPos(pos) {}
+	Particle(ParticleStore* store, Vec2 pos): store(store), index(store->add(pos, this)) {}
+	
+	// handle for an entry already in the store
+	Particle(ParticleStore* store, int index): store(store), index(index) {
+		store->handles[index] = this;
+	}
 	
-	void draw() {
-		glColor3ub(45, 173, 143);
-		glPointSize(4);
-		glBegin(GL_POINTS);{
-			glVertex2f(pos.x, pos.y);
-		}glEnd();
+	void draw(Renderer& r) {
+		r.point(getPos(), 4, Color(45, 173, 143));
 	}
 	
 	Vec2 getPos() {
-		return pos;
+		return Vec2(store->x[index], store->y[index]);
 	}
 	
 	void setPos(Vec2 p) {
-		pos = p;
+		store->x[index] = p.x;
+		store->y[index] = p.y;
+	}
+	
+	Vec2 getLastPos() {
+		return Vec2(store->lastX[index], store->lastY[index]);
+	}
+	
+	void setLastPos(Vec2 p) {
+		store->lastX[index] = p.x;
+		store->lastY[index] = p.y;
 	}
 };
 
@@ -0,0 +1,124 @@
+// Profiler -- time spent in each phase of a step, summed per frame and kept over
+// a rolling window of frames for averages and percentiles. Instrumentation is
+// compiled in only with VERLET_PROFILE defined; without it PROFILE_SCOPE expands
+// to nothing and the profiler stays empty.
+//
+// Phases run by several threads at once add up their time, so with the parallel
+// solvers a phase can exceed the wall time of the frame.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+enum ProfilePhase {
+	PROFILE_STEP,
+	PROFILE_INTEGRATE,
+	PROFILE_RELAX_DISTANCE,
+	PROFILE_RELAX_ANGLE,
+	PROFILE_RELAX_OTHER,
+	PROFILE_RELAX_PIN,
+	PROFILE_CONTACTS,
+	PROFILE_BOUNDS,
+	PROFILE_PICK,
+	PROFILE_DRAW,
+	PROFILE_PHASES
+};
+
+inline const char* profilePhaseName(ProfilePhase phase) {
+	static const char* names[PROFILE_PHASES] = {
+		"step", "integrate", "relax distance", "relax angle", "relax other", "relax pin", "contacts", "bounds", "pick", "draw"
+	};
+	return names[phase];
+}
+
+struct Profiler {
+	// frames kept for averages and percentiles
+	static const int window = 120;
+	
+	// nanoseconds of the frame in progress
+	atomic<long long> pending[PROFILE_PHASES];
+	
+	// milliseconds of the last frames, a ring of window entries per phase
+	double samples[PROFILE_PHASES][window];
+	int frames = 0;
+	
+	Profiler() {
+		reset();
+	}
+	
+	void reset() {
+		int p;
+		for (p=0; p<PROFILE_PHASES; p++)
+			pending[p] = 0;
+		frames = 0;
+	}
+	
+	void add(ProfilePhase phase, long long ns) {
+		pending[phase].fetch_add(ns, memory_order_relaxed);
+	}
+	
+	// closes the current frame, call once per displayed frame (or per step when headless)
+	void frame() {
+		int p, slot = frames % window;
+		for (p=0; p<PROFILE_PHASES; p++)
+			samples[p][slot] = pending[p].exchange(0)*1.0e-6;
+		frames++;
+	}
+	
+	int count() {
+		return frames < window ? frames : window;
+	}
+	
+	// milliseconds per frame averaged over the window
+	double average(ProfilePhase phase) {
+		int i, n = count();
+		double sum = 0;
+		for (i=0; i<n; i++)
+			sum += samples[phase][i];
+		return n ? sum/n : 0;
+	}
+	
+	// milliseconds per frame not exceeded by fraction p of the window, p in [0, 1]
+	double percentile(ProfilePhase phase, double p) {
+		int n = count();
+		if (n == 0)
+			return 0;
+		
+		double sorted[window];
+		copy(samples[phase], samples[phase]+n, sorted);
+		int k = min(n-1, max(0, (int)(p*n)));
+		nth_element(sorted, sorted+k, sorted+n);
+		return sorted[k];
+	}
+	
+	// shared by every world, like ThreadPool::shared()
+	static Profiler& shared() {
+		static Profiler profiler;
+		return profiler;
+	}
+};
+
+// adds the time until the end of the enclosing block to a phase
+struct ProfileScope {
+	ProfilePhase phase;
+	chrono::steady_clock::time_point start;
+	
+	ProfileScope(ProfilePhase phase): phase(phase), start(chrono::steady_clock::now()) {}
+	
+	~ProfileScope() {
+		Profiler::shared().add(phase, chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count());
+	}
+};
+
+#ifdef VERLET_PROFILE
+#define PROFILE_CONCAT2(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT2(a, b)
+#define PROFILE_SCOPE(phase) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(phase)
+#else
+#define PROFILE_SCOPE(phase)
+#endif
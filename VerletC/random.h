@@ -0,0 +1,36 @@
+// Random -- small seeded generator owned by each world, so that scenes built and
+// stepped from the same seed behave the same in every run and on every thread.
+
+#pragma once
+
+#include <stdint.h>
+
+struct Random {
+	uint64_t state;
+	
+	Random(uint64_t seed = 1) {
+		this->seed(seed);
+	}
+	
+	void seed(uint64_t seed) {
+		state = seed;
+	}
+	
+	// splitmix64
+	uint64_t next() {
+		uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+		return z ^ (z >> 31);
+	}
+	
+	// integer in [0, n)
+	int below(int n) {
+		return (int)((next() >> 32) * (uint64_t)n >> 32);
+	}
+	
+	// float in [0, 1)
+	float uniform() {
+		return (next() >> 40) * (1.0f/16777216.0f);
+	}
+};
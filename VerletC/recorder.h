@@ -0,0 +1,415 @@
+// TrajectoryRecorder -- streams particle positions of every step to disk.
+// The stepping thread copies positions into a ring of frame buffers and a writer
+// thread drains it: positions are quantized to a fixed grid, delta-encoded
+// against the previous frame and stored as zigzag varints, in chunks that
+// start with a keyframe (deltas against zero). An index of the chunks at the
+// end of the file lets TrajectoryReader seek to any frame by decoding from the
+// keyframe of its chunk.
+//
+// file:  header | chunk... | index | footer
+// chunk: firstFrame, frames, particles, bytes (uint32 each) | varints, x then y per frame
+
+#pragma once
+
+#include "particle.h"
+#include "random.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+
+static const char trajectoryMagic[4] = {'V', 'T', 'R', 'J'};
+static const uint32_t trajectoryVersion = 1;
+
+struct TrajectoryHeader {
+	char magic[4];
+	uint32_t version;
+	
+	// positions are stored as multiples of quantum
+	float quantum;
+	uint32_t reserved;
+};
+
+struct TrajectoryChunk {
+	uint32_t firstFrame;
+	uint32_t frames;
+	uint32_t particles;
+	uint32_t bytes;
+};
+
+struct TrajectoryIndexEntry {
+	uint64_t offset;
+	uint32_t firstFrame;
+	uint32_t frames;
+};
+
+struct TrajectoryFooter {
+	uint64_t indexOffset;
+	uint32_t chunks;
+	char magic[4];
+};
+
+inline void putVarint(vector<uint8_t>& out, int32_t v) {
+	uint32_t z = ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+	while (z >= 0x80) {
+		out.push_back((uint8_t)(z | 0x80));
+		z >>= 7;
+	}
+	out.push_back((uint8_t)z);
+}
+
+inline int32_t getVarint(const uint8_t*& p, const uint8_t* end) {
+	uint32_t z = 0;
+	int shift = 0;
+	while (p < end && shift < 35) {
+		uint8_t b = *p++;
+		z |= (uint32_t)(b & 0x7f) << shift;
+		if (!(b & 0x80))
+			break;
+		shift += 7;
+	}
+	return (int32_t)(z >> 1) ^ -(int32_t)(z & 1);
+}
+
+struct TrajectoryRecorder {
+	// grid the positions are rounded to, the error is at most quantum/2
+	float quantum = 1.0f/256.0f;
+	
+	// frames per chunk, seeking decodes at most this many frames
+	int keyframeInterval = 60;
+	
+	// frame buffers between the stepping thread and the writer
+	struct Frame {
+		vector<float> x;
+		vector<float> y;
+	};
+	vector<Frame> ring;
+	atomic<int> head;
+	atomic<int> tail;
+	
+	// times record() had to wait for the writer
+	int stalls = 0;
+	int frames = 0;
+	
+	FILE* file = NULL;
+	thread writer;
+	atomic<bool> closing;
+	
+	// writer state
+	vector<int32_t> previous;
+	vector<int32_t> current;
+	vector<uint8_t> payload;
+	TrajectoryChunk chunk;
+	vector<TrajectoryIndexEntry> index;
+	bool failed = false;
+	
+	TrajectoryRecorder(): head(0), tail(0), closing(false) {}
+	
+	// ringFrames: frames that may be queued before record() waits
+	bool open(const char* path, int ringFrames = 16) {
+		close();
+		
+		file = fopen(path, "wb");
+		if (!file)
+			return false;
+		
+		TrajectoryHeader h;
+		memset(&h, 0, sizeof(h));
+		memcpy(h.magic, trajectoryMagic, 4);
+		h.version = trajectoryVersion;
+		h.quantum = quantum;
+		failed = fwrite(&h, sizeof(h), 1, file) != 1;
+		
+		ring.assign(ringFrames+1, Frame());
+		head = 0;
+		tail = 0;
+		frames = 0;
+		stalls = 0;
+		index.clear();
+		chunk.frames = 0;
+		closing = false;
+		writer = thread(&TrajectoryRecorder::drain, this);
+		return !failed;
+	}
+	
+	bool isOpen() {
+		return file != NULL;
+	}
+	
+	// copies the positions of every particle of the store as the next frame
+	void record(ParticleStore& store) {
+		int h = head.load(memory_order_relaxed);
+		int next = (h+1) % (int)ring.size();
+		if (next == tail.load(memory_order_acquire)) {
+			stalls++;
+			while (next == tail.load(memory_order_acquire))
+				this_thread::yield();
+		}
+		
+		Frame& frame = ring[h];
+		frame.x.assign(store.x.begin(), store.x.end());
+		frame.y.assign(store.y.begin(), store.y.end());
+		head.store(next, memory_order_release);
+		frames++;
+	}
+	
+	void drain() {
+		while (true) {
+			int t = tail.load(memory_order_relaxed);
+			if (t == head.load(memory_order_acquire)) {
+				if (closing.load())
+					break;
+				this_thread::sleep_for(chrono::microseconds(500));
+				continue;
+			}
+			
+			encode(ring[t]);
+			tail.store((t+1) % (int)ring.size(), memory_order_release);
+		}
+		
+		flush();
+	}
+	
+	void encode(Frame& frame) {
+		int n = (int)frame.x.size();
+		if (chunk.frames >= keyframeInterval || (chunk.frames > 0 && n != chunk.particles))
+			flush();
+		
+		if (chunk.frames == 0) {
+			chunk.firstFrame = index.empty() ? 0 : index.back().firstFrame + index.back().frames;
+			chunk.particles = n;
+			previous.assign(2*n, 0);
+		}
+		
+		current.resize(2*n);
+		int i;
+		for (i=0; i<n; i++) {
+			current[i] = (int32_t)lrintf(frame.x[i]/quantum);
+			current[n+i] = (int32_t)lrintf(frame.y[i]/quantum);
+		}
+		for (i=0; i<2*n; i++)
+			putVarint(payload, current[i] - previous[i]);
+		
+		previous.swap(current);
+		chunk.frames++;
+	}
+	
+	void flush() {
+		if (chunk.frames == 0)
+			return;
+		
+		TrajectoryIndexEntry entry;
+		entry.offset = ftell(file);
+		entry.firstFrame = chunk.firstFrame;
+		entry.frames = chunk.frames;
+		index.push_back(entry);
+		
+		chunk.bytes = (uint32_t)payload.size();
+		failed |= fwrite(&chunk, sizeof(chunk), 1, file) != 1;
+		if (!payload.empty())
+			failed |= fwrite(payload.data(), payload.size(), 1, file) != 1;
+		
+		payload.clear();
+		chunk.frames = 0;
+	}
+	
+	// waits for the queued frames, writes the index, false if anything failed to write
+	bool close() {
+		if (!file)
+			return true;
+		
+		closing = true;
+		writer.join();
+		
+		TrajectoryFooter footer;
+		memset(&footer, 0, sizeof(footer));
+		footer.indexOffset = ftell(file);
+		footer.chunks = (uint32_t)index.size();
+		memcpy(footer.magic, trajectoryMagic, 4);
+		if (!index.empty())
+			failed |= fwrite(index.data(), sizeof(TrajectoryIndexEntry), index.size(), file) != index.size();
+		failed |= fwrite(&footer, sizeof(footer), 1, file) != 1;
+		failed |= fclose(file) != 0;
+		file = NULL;
+		return !failed;
+	}
+	
+	~TrajectoryRecorder() {
+		close();
+	}
+};
+
+struct TrajectoryReader {
+	FILE* file = NULL;
+	float quantum = 1;
+	vector<TrajectoryIndexEntry> index;
+	
+	// the chunk being decoded and the frame its state holds
+	int chunkIndex = -1;
+	TrajectoryChunk chunk;
+	vector<uint8_t> payload;
+	const uint8_t* cursor = NULL;
+	int decoded = -1;
+	vector<int32_t> state;
+	
+	// false if the file is missing, truncated or was not closed by the recorder
+	bool open(const char* path) {
+		close();
+		
+		file = fopen(path, "rb");
+		if (!file)
+			return false;
+		
+		TrajectoryHeader h;
+		TrajectoryFooter footer;
+		bool valid = fread(&h, sizeof(h), 1, file) == 1 && !memcmp(h.magic, trajectoryMagic, 4) && h.version == trajectoryVersion &&
+			fseek(file, -(long)sizeof(footer), SEEK_END) == 0 && fread(&footer, sizeof(footer), 1, file) == 1 &&
+			!memcmp(footer.magic, trajectoryMagic, 4);
+		
+		if (valid) {
+			quantum = h.quantum;
+			index.resize(footer.chunks);
+			valid = fseek(file, (long)footer.indexOffset, SEEK_SET) == 0 &&
+				(index.empty() || fread(index.data(), sizeof(TrajectoryIndexEntry), index.size(), file) == index.size());
+		}
+		
+		if (!valid)
+			close();
+		return valid;
+	}
+	
+	int frames() {
+		return index.empty() ? 0 : index.back().firstFrame + index.back().frames;
+	}
+	
+	// positions of a frame, false if it is out of range or its chunk is damaged;
+	// reading frames in order decodes each only once
+	bool seek(int frame, vector<float>& x, vector<float>& y) {
+		if (!file || frame < 0 || frame >= frames())
+			return false;
+		
+		// chunk holding the frame
+		int lo = 0, hi = (int)index.size()-1;
+		while (lo < hi) {
+			int mid = (lo+hi+1)/2;
+			if (index[mid].firstFrame <= frame)
+				lo = mid;
+			else
+				hi = mid-1;
+		}
+		
+		if (lo != chunkIndex || frame < decoded) {
+			if (!load(lo))
+				return false;
+		}
+		
+		int n = chunk.particles;
+		const uint8_t* end = payload.data() + payload.size();
+		int i;
+		while (decoded < frame) {
+			for (i=0; i<2*n; i++)
+				state[i] += getVarint(cursor, end);
+			decoded++;
+		}
+		
+		x.resize(n);
+		y.resize(n);
+		for (i=0; i<n; i++) {
+			x[i] = state[i]*quantum;
+			y[i] = state[n+i]*quantum;
+		}
+		return true;
+	}
+	
+	bool load(int c) {
+		chunkIndex = -1;
+		if (fseek(file, (long)index[c].offset, SEEK_SET) != 0 || fread(&chunk, sizeof(chunk), 1, file) != 1)
+			return false;
+		
+		payload.resize(chunk.bytes);
+		if (chunk.bytes && fread(payload.data(), chunk.bytes, 1, file) != 1)
+			return false;
+		
+		chunkIndex = c;
+		cursor = payload.data();
+		decoded = (int)chunk.firstFrame - 1;
+		state.assign(2*chunk.particles, 0);
+		return true;
+	}
+	
+	void close() {
+		if (file)
+			fclose(file);
+		file = NULL;
+		index.clear();
+		chunkIndex = -1;
+	}
+	
+	~TrajectoryReader() {
+		close();
+	}
+};
+
+// particles wandering over a few hundred frames, with one added halfway: every
+// decoded position is within quantum/2 of the recorded one, and seeking in any
+// order across chunks gives the same frames as reading in order
+void test_Trajectory() {
+	const char* path = "/tmp/verletc-trajectory-test";
+	const int count = 250;
+	
+	Random random(5);
+	ParticleStore store;
+	int i, f;
+	for (i=0; i<100; i++)
+		store.add(Vec2(random.uniform()*800, random.uniform()*500));
+	
+	// a small ring, so the stepping side also has to wait for the writer
+	TrajectoryRecorder recorder;
+	bool opened = recorder.open(path, 2);
+	
+	vector<vector<float> > recordedX, recordedY;
+	for (f=0; f<count; f++) {
+		if (f == 130)
+			store.add(Vec2(400, 250));
+		for (i=0; i<store.size(); i++) {
+			store.x[i] += (random.uniform()-0.5f)*f*0.1f;
+			store.y[i] += (random.uniform()-0.5f)*f*0.1f;
+		}
+		recorder.record(store);
+		recordedX.push_back(store.x);
+		recordedY.push_back(store.y);
+	}
+	bool closed = recorder.close();
+	
+	TrajectoryReader reader;
+	bool read = reader.open(path) && reader.frames() == count;
+	
+	float error = 0;
+	vector<vector<float> > sequentialX(count), sequentialY(count);
+	for (f=0; read && f<count; f++) {
+		read = reader.seek(f, sequentialX[f], sequentialY[f]) && sequentialX[f].size() == recordedX[f].size();
+		for (i=0; read && i<recordedX[f].size(); i++) {
+			error = fmaxf(error, fabsf(sequentialX[f][i] - recordedX[f][i]));
+			error = fmaxf(error, fabsf(sequentialY[f][i] - recordedY[f][i]));
+		}
+	}
+	
+	bool seeks = read;
+	vector<float> x, y;
+	for (i=0; seeks && i<500; i++) {
+		f = random.below(count);
+		seeks = reader.seek(f, x, y) && x == sequentialX[f] && y == sequentialY[f];
+	}
+	seeks &= !reader.seek(count, x, y) && !reader.seek(-1, x, y);
+	
+	reader.close();
+	remove(path);
+	
+	bool exact = error <= recorder.quantum/2;
+	cout << "Trajectory: " << (opened && closed && read && seeks && exact ? "PASS" : "FAIL") << " max error " << error << ", " << recorder.stalls << " stalls\n";
+}
@@ -0,0 +1,28 @@
+// Renderer -- the drawing primitives used by the composites. A graphics backend
+// implements it so that the simulation itself never calls into one.
+
+#pragma once
+
+#include "vec2.h"
+
+struct Color {
+	unsigned char r;
+	unsigned char g;
+	unsigned char b;
+	unsigned char a;
+	
+	Color(unsigned char r, unsigned char g, unsigned char b, unsigned char a = 255): r(r), g(g), b(b), a(a) {}
+	
+	static Color fromFloat(float r, float g, float b, float a = 1.0f) {
+		return Color(r*255.0f, g*255.0f, b*255.0f, a*255.0f);
+	}
+};
+
+struct Renderer {
+	virtual void point(Vec2 p, float size, Color color) = 0;
+	virtual void line(Vec2 a, Vec2 b, float width, Color color) = 0;
+	virtual void circle(Vec2 center, float radius, Color color, bool filled = true) = 0;
+	virtual void quad(Vec2 a, Vec2 b, Vec2 c, Vec2 d, Color color) = 0;
+	
+	virtual ~Renderer() {}
+};
@@ -0,0 +1,154 @@
+// RenderList -- a Renderer that records a frame into flat vertex arrays instead of
+// drawing. Every primitive becomes triangles, so that a list can be drawn with a
+// single call whatever the sizes and colors in it: points and circles are fans
+// over a precomputed unit circle, lines are quads as wide as the line, and quads
+// are two triangles. The lists are drawn in the order quads, lines, circles,
+// points; within a list the order of the calls is kept.
+//
+// Nothing here calls a graphics library, so a frame can be built and checked
+// headless; src/glrenderer.h submits the lists to OpenGL.
+
+#pragma once
+
+#include "render.h"
+
+#include <vector>
+#include <math.h>
+#include <iostream>
+
+using namespace std;
+
+struct RenderVertex {
+	float x;
+	float y;
+	Color color;
+};
+
+typedef vector<RenderVertex> RenderVertices;
+
+// a unit circle, computed once for all the circles and points
+struct CircleGeometry {
+	static const int segments = 16;
+	
+	float x[segments];
+	float y[segments];
+	
+	CircleGeometry() {
+		int i;
+		for (i=0; i<segments; i++) {
+			float a = i/(float)segments*2.0f*M_PI;
+			x[i] = cosf(a);
+			y[i] = sinf(a);
+		}
+	}
+	
+	static const CircleGeometry& shared() {
+		static CircleGeometry geometry;
+		return geometry;
+	}
+};
+
+struct RenderList : public Renderer {
+	RenderVertices quads;
+	RenderVertices lines;
+	RenderVertices circles;
+	RenderVertices points;
+	
+	// keeps the memory for the next frame
+	void clear() {
+		quads.clear();
+		lines.clear();
+		circles.clear();
+		points.clear();
+	}
+	
+	int size() {
+		return (int)(quads.size() + lines.size() + circles.size() + points.size());
+	}
+	
+	static void triangle(RenderVertices& v, Vec2 a, Vec2 b, Vec2 c, Color color) {
+		RenderVertex va = {a.x, a.y, color};
+		RenderVertex vb = {b.x, b.y, color};
+		RenderVertex vc = {c.x, c.y, color};
+		v.push_back(va);
+		v.push_back(vb);
+		v.push_back(vc);
+	}
+	
+	// a segment as wide as width, nothing when a and b coincide
+	static void segment(RenderVertices& v, Vec2 a, Vec2 b, float width, Color color) {
+		Vec2 d = b - a;
+		float length = d.length();
+		if (length <= 0)
+			return;
+		
+		Vec2 n = Vec2(-d.y, d.x)*(0.5f*width/length);
+		triangle(v, a+n, b+n, b-n, color);
+		triangle(v, a+n, b-n, a-n, color);
+	}
+	
+	// a fan over the unit circle, or its outline one unit wide
+	void disc(RenderVertices& v, Vec2 center, float radius, Color color, bool filled) {
+		const CircleGeometry& g = CircleGeometry::shared();
+		const int n = CircleGeometry::segments;
+		int i;
+		if (filled) {
+			Vec2 first = Vec2(center.x + g.x[0]*radius, center.y + g.y[0]*radius);
+			for (i=1; i+1<n; i++)
+				triangle(v, first,
+						 Vec2(center.x + g.x[i]*radius, center.y + g.y[i]*radius),
+						 Vec2(center.x + g.x[i+1]*radius, center.y + g.y[i+1]*radius), color);
+		} else {
+			for (i=0; i<n; i++)
+				segment(v,
+						Vec2(center.x + g.x[i]*radius, center.y + g.y[i]*radius),
+						Vec2(center.x + g.x[(i+1)%n]*radius, center.y + g.y[(i+1)%n]*radius), 1.0f, color);
+		}
+	}
+	
+	void point(Vec2 p, float size, Color color) {
+		disc(points, p, 0.5f*size, color, true);
+	}
+	
+	void line(Vec2 a, Vec2 b, float width, Color color) {
+		segment(lines, a, b, width, color);
+	}
+	
+	void circle(Vec2 center, float radius, Color color, bool filled = true) {
+		disc(circles, center, radius, color, filled);
+	}
+	
+	void quad(Vec2 a, Vec2 b, Vec2 c, Vec2 d, Color color) {
+		triangle(quads, a, b, c, color);
+		triangle(quads, a, c, d, color);
+	}
+};
+
+// the vertices of each primitive land in its list, on the circle or line they describe
+void test_RenderList() {
+	RenderList list;
+	list.quad(Vec2(0, 0), Vec2(1, 0), Vec2(1, 1), Vec2(0, 1), Color(1, 2, 3, 4));
+	list.line(Vec2(0, 0), Vec2(10, 0), 2, Color(255, 0, 0));
+	list.line(Vec2(5, 5), Vec2(5, 5), 2, Color(255, 0, 0));
+	list.circle(Vec2(100, 50), 8, Color(0, 255, 0));
+	list.circle(Vec2(100, 50), 8, Color(0, 255, 0), false);
+	list.point(Vec2(-20, 30), 4, Color(0, 0, 255));
+	
+	const int n = CircleGeometry::segments;
+	bool counts = list.quads.size() == 6 && list.lines.size() == 6 && list.circles.size() == 3*(n-2) + 6*n && list.points.size() == 3*(n-2);
+	
+	float error = 0;
+	int i;
+	for (i=0; i<3*(n-2); i++) {
+		error = fmaxf(error, fabsf((Vec2(list.circles[i].x, list.circles[i].y) - Vec2(100, 50)).length() - 8));
+		error = fmaxf(error, fabsf((Vec2(list.points[i].x, list.points[i].y) - Vec2(-20, 30)).length() - 2));
+	}
+	for (i=0; i<6; i++)
+		error = fmaxf(error, fabsf(fabsf(list.lines[i].y) - 1));
+	
+	bool colors = list.quads[5].color.a == 4 && list.circles.back().color.g == 255 && list.points[0].color.b == 255;
+	
+	list.clear();
+	
+	cout << "RenderList: " << (counts && colors && error < 1e-4f && list.size() == 0 ? "PASS" : "FAIL") << " max error " << error << "\n";
+}
@@ -0,0 +1,136 @@
+// ReplayLog -- what is needed to run a session again: the seed of the world, the
+// duration and iterations of every step, the mouse input between steps and a hash
+// of the particle state after each step. VerletJS fills it while
+// VerletJS::replayLog is set, and VerletJS::replay() runs it back and finds the
+// first step whose state differs.
+
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <vector>
+
+using namespace std;
+
+struct ReplayStep {
+	float dt;
+	int32_t iterations;
+	uint64_t hash;
+};
+
+struct ReplayEvent {
+	enum Type {
+		MOUSE_MOVE,
+		MOUSE_CLICK
+	};
+	
+	// number of steps run before the event
+	int32_t step;
+	int32_t type;
+	int32_t button;
+	int32_t down;
+	int32_t x;
+	int32_t y;
+};
+
+static const char replayMagic[4] = {'V', 'R', 'P', 'L'};
+static const uint32_t replayVersion = 3;
+
+struct ReplayLog {
+	uint64_t seed = 1;
+	
+	// opaque to the engine, the application records which scene it built
+	int32_t scene = 0;
+	int32_t width = 0;
+	int32_t height = 0;
+	
+	// solver settings that change results, applied before the first step
+	int32_t solver = 0;
+	int32_t collisions = 0;
+	int32_t adaptive = 0;
+	int32_t minIterations = 0;
+	float tolerance = 0;
+	int32_t sleep = 0;
+	int32_t sleepSteps = 0;
+	float sleepEnergy = 0;
+	
+	vector<ReplayStep> steps;
+	vector<ReplayEvent> events;
+	
+	void clear() {
+		steps.clear();
+		events.clear();
+	}
+	
+	bool save(const char* path) {
+		FILE* f = fopen(path, "wb");
+		if (!f)
+			return false;
+		
+		uint32_t counts[2] = {(uint32_t)steps.size(), (uint32_t)events.size()};
+		int32_t world[9] = {scene, width, height, solver, collisions, adaptive, minIterations, sleep, sleepSteps};
+		float thresholds[2] = {tolerance, sleepEnergy};
+		bool ok = fwrite(replayMagic, 4, 1, f) == 1 &&
+			fwrite(&replayVersion, sizeof(replayVersion), 1, f) == 1 &&
+			fwrite(&seed, sizeof(seed), 1, f) == 1 &&
+			fwrite(world, sizeof(world), 1, f) == 1 &&
+			fwrite(thresholds, sizeof(thresholds), 1, f) == 1 &&
+			fwrite(counts, sizeof(counts), 1, f) == 1 &&
+			(steps.empty() || fwrite(steps.data(), sizeof(ReplayStep), steps.size(), f) == steps.size()) &&
+			(events.empty() || fwrite(events.data(), sizeof(ReplayEvent), events.size(), f) == events.size());
+		
+		return fclose(f) == 0 && ok;
+	}
+	
+	bool load(const char* path) {
+		FILE* f = fopen(path, "rb");
+		if (!f)
+			return false;
+		
+		char magic[4];
+		uint32_t version;
+		uint32_t counts[2];
+		int32_t world[9];
+		float thresholds[2];
+		bool ok = fread(magic, 4, 1, f) == 1 && !memcmp(magic, replayMagic, 4) &&
+			fread(&version, sizeof(version), 1, f) == 1 && version == replayVersion &&
+			fread(&seed, sizeof(seed), 1, f) == 1 &&
+			fread(world, sizeof(world), 1, f) == 1 &&
+			fread(thresholds, sizeof(thresholds), 1, f) == 1 &&
+			fread(counts, sizeof(counts), 1, f) == 1;
+		
+		if (ok) {
+			scene = world[0];
+			width = world[1];
+			height = world[2];
+			solver = world[3];
+			collisions = world[4];
+			adaptive = world[5];
+			minIterations = world[6];
+			sleep = world[7];
+			sleepSteps = world[8];
+			tolerance = thresholds[0];
+			sleepEnergy = thresholds[1];
+			
+			steps.resize(counts[0]);
+			events.resize(counts[1]);
+			ok = (steps.empty() || fread(steps.data(), sizeof(ReplayStep), steps.size(), f) == steps.size()) &&
+				(events.empty() || fread(events.data(), sizeof(ReplayEvent), events.size(), f) == events.size());
+		}
+		
+		fclose(f);
+		if (!ok)
+			clear();
+		return ok;
+	}
+};
+
+// FNV-1a over 32-bit words
+inline uint64_t hashWords(uint64_t h, const void* data, size_t count) {
+	const uint32_t* w = (const uint32_t*)data;
+	size_t i;
+	for (i=0; i<count; i++)
+		h = (h ^ w[i]) * 0x100000001B3ull;
+	return h;
+}
@@ -0,0 +1,172 @@
+// SlotMap -- values in a dense array, addressed through generational handles.
+// Insert and remove are O(1): a removed value is replaced by the last one, and its
+// slot is recycled with the next generation, so a handle to a removed value is
+// recognized as stale instead of reaching whatever took its place. Iteration goes
+// over the dense array like a vector, whose order changes on removal.
+//
+// A value that wants to know its own position in the dense array provides an
+// overload of slotMoved(value, position), as Constraint* does.
+
+#pragma once
+
+#include <vector>
+#include <iostream>
+#include <stdint.h>
+
+using namespace std;
+
+struct SlotHandle {
+	uint32_t slot = UINT32_MAX;
+	uint32_t generation = 0;
+	
+	bool operator==(const SlotHandle& h) const {
+		return slot == h.slot && generation == h.generation;
+	}
+	
+	bool operator!=(const SlotHandle& h) const {
+		return !(*this == h);
+	}
+};
+
+template<typename T>
+inline void slotMoved(T& value, int position) {
+}
+
+template<typename T>
+struct SlotMap {
+	vector<T> values;
+	
+	// dense position of each value's slot, and back
+	vector<uint32_t> slotOf;
+	vector<uint32_t> position;
+	
+	// generation of each slot, bumped when its value is removed
+	vector<uint32_t> generation;
+	
+	// free slots, reused last in first out
+	vector<uint32_t> freeSlots;
+	
+	typedef typename vector<T>::iterator iterator;
+	
+	SlotHandle insert(const T& value) {
+		uint32_t slot;
+		if (freeSlots.empty()) {
+			slot = (uint32_t)position.size();
+			position.push_back(0);
+			generation.push_back(0);
+		} else {
+			slot = freeSlots.back();
+			freeSlots.pop_back();
+		}
+		
+		position[slot] = (uint32_t)values.size();
+		slotOf.push_back(slot);
+		values.push_back(value);
+		slotMoved(values.back(), (int)values.size()-1);
+		
+		SlotHandle h;
+		h.slot = slot;
+		h.generation = generation[slot];
+		return h;
+	}
+	
+	void push_back(const T& value) {
+		insert(value);
+	}
+	
+	bool contains(SlotHandle h) {
+		return h.slot < generation.size() && generation[h.slot] == h.generation;
+	}
+	
+	// NULL for a stale handle
+	T* get(SlotHandle h) {
+		return contains(h) ? &values[position[h.slot]] : NULL;
+	}
+	
+	// handle of the value at a dense position
+	SlotHandle handle(int i) {
+		SlotHandle h;
+		h.slot = slotOf[i];
+		h.generation = generation[h.slot];
+		return h;
+	}
+	
+	// false for a stale handle
+	bool remove(SlotHandle h) {
+		if (!contains(h))
+			return false;
+		
+		uint32_t i = position[h.slot], last = (uint32_t)values.size()-1;
+		if (i != last) {
+			values[i] = values[last];
+			slotOf[i] = slotOf[last];
+			position[slotOf[i]] = i;
+			slotMoved(values[i], (int)i);
+		}
+		values.pop_back();
+		slotOf.pop_back();
+		
+		generation[h.slot]++;
+		freeSlots.push_back(h.slot);
+		return true;
+	}
+	
+	void clear() {
+		int i;
+		for (i=0; i<slotOf.size(); i++) {
+			generation[slotOf[i]]++;
+			freeSlots.push_back(slotOf[i]);
+		}
+		values.clear();
+		slotOf.clear();
+	}
+	
+	void reserve(int n) {
+		values.reserve(n);
+		slotOf.reserve(n);
+	}
+	
+	int size() const {
+		return (int)values.size();
+	}
+	
+	bool empty() const {
+		return values.empty();
+	}
+	
+	T& operator[](int i) {
+		return values[i];
+	}
+	
+	iterator begin() {
+		return values.begin();
+	}
+	
+	iterator end() {
+		return values.end();
+	}
+};
+
+void test_SlotMap() {
+	SlotMap<int> map;
+	vector<SlotHandle> handles;
+	int i;
+	for (i=0; i<100; i++)
+		handles.push_back(map.insert(i));
+	
+	// remove every third value, their handles go stale and the others still resolve
+	bool ok = true;
+	for (i=0; i<100; i+=3)
+		ok &= map.remove(handles[i]);
+	ok &= !map.remove(handles[0]) && map.size() == 100-34;
+	for (i=0; i<100; i++)
+		ok &= i%3 == 0 ? map.get(handles[i]) == NULL : *map.get(handles[i]) == i;
+	
+	// recycled slots get a new generation
+	SlotHandle h = map.insert(1000);
+	ok &= h.slot == handles[99].slot && h != handles[99] && !map.get(handles[99]) && *map.get(h) == 1000;
+	for (i=0; i<map.size(); i++)
+		ok &= map.get(map.handle(i)) == &map[i];
+	
+	cout << "SlotMap: " << (ok ? "PASS" : "FAIL") << "\n";
+}
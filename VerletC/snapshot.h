@@ -0,0 +1,519 @@
+// Snapshot -- versioned binary checkpoint of a world. The file is a header followed
+// by flat arrays (positions, constraint endpoints as store indices, rest values),
+// so it holds no pointers and can be mapped and read in place, or bulk-copied back
+// into a world by loadSnapshot().
+//
+// Restored composites are plain Composites: their particles and constraints are
+// exact, but behavior of subclasses (a spider crawling, a tree's drawing) is not
+// part of the snapshot.
+
+#pragma once
+
+#include "verlet.h"
+#include "objects.h"
+#include "tree.h"
+#include "cloth.h"
+#include "gridcloth.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+enum SnapshotArray {
+	SNAPSHOT_X,
+	SNAPSHOT_Y,
+	SNAPSHOT_LAST_X,
+	SNAPSHOT_LAST_Y,
+	SNAPSHOT_RADIUS,
+	SNAPSHOT_COMPOSITES,
+	SNAPSHOT_DISTANCE_A,
+	SNAPSHOT_DISTANCE_B,
+	SNAPSHOT_DISTANCE,
+	SNAPSHOT_DISTANCE_STIFFNESS,
+	SNAPSHOT_DISTANCE_TEAR,
+	SNAPSHOT_ANGLE_A,
+	SNAPSHOT_ANGLE_B,
+	SNAPSHOT_ANGLE_C,
+	SNAPSHOT_ANGLE,
+	SNAPSHOT_ANGLE_STIFFNESS,
+	SNAPSHOT_PIN_A,
+	SNAPSHOT_PIN_X,
+	SNAPSHOT_PIN_Y,
+	SNAPSHOT_ARRAYS
+};
+
+// a composite is a range of particles and the next constraints of each type
+struct SnapshotComposite {
+	int32_t first;
+	int32_t particles;
+	int32_t distances;
+	int32_t angles;
+	int32_t pins;
+	int32_t selfCollision;
+};
+
+struct SnapshotHeader {
+	char magic[4];
+	uint32_t version;
+	
+	// world
+	int32_t width;
+	int32_t height;
+	float gravityX;
+	float gravityY;
+	float friction;
+	float groundFriction;
+	float fixedStep;
+	int32_t maxSubsteps;
+	int32_t collisions;
+	
+	// seed of the world and state of its generator, so that a restored world
+	// makes the same random choices
+	uint64_t seed;
+	uint64_t random;
+	
+	// element counts
+	int32_t particles;
+	int32_t composites;
+	int32_t distances;
+	int32_t angles;
+	int32_t pins;
+	
+	// byte offset of each array from the start of the file, 8-byte aligned
+	uint64_t offsets[SNAPSHOT_ARRAYS];
+};
+
+static const char snapshotMagic[4] = {'V', 'R', 'L', 'T'};
+static const uint32_t snapshotVersion = 3;
+
+// number of elements and element size of an array
+inline void snapshotExtent(const SnapshotHeader& h, SnapshotArray which, size_t& count, size_t& bytes) {
+	bytes = 4;
+	if (which <= SNAPSHOT_RADIUS)
+		count = h.particles;
+	else if (which == SNAPSHOT_COMPOSITES) {
+		count = h.composites;
+		bytes = sizeof(SnapshotComposite);
+	} else if (which <= SNAPSHOT_DISTANCE_TEAR)
+		count = h.distances;
+	else if (which <= SNAPSHOT_ANGLE_STIFFNESS)
+		count = h.angles;
+	else
+		count = h.pins;
+}
+
+// a snapshot file mapped read-only, arrays are used in place
+struct Snapshot {
+	char* data = NULL;
+	size_t size = 0;
+	
+	SnapshotHeader* header() {
+		return (SnapshotHeader*)data;
+	}
+	
+	template<typename T>
+	const T* array(SnapshotArray which) {
+		return (const T*)(data + header()->offsets[which]);
+	}
+	
+	// false if the file can not be mapped, is not a snapshot of this version,
+	// or is too short for the arrays its header announces
+	bool open(const char* path) {
+		close();
+		
+		int fd = ::open(path, O_RDONLY);
+		if (fd < 0)
+			return false;
+		
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(SnapshotHeader)) {
+			::close(fd);
+			return false;
+		}
+		
+		void* p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd);
+		if (p == MAP_FAILED)
+			return false;
+		
+		data = (char*)p;
+		size = st.st_size;
+		
+		SnapshotHeader* h = header();
+		bool valid = !memcmp(h->magic, snapshotMagic, 4) && h->version == snapshotVersion &&
+			h->particles >= 0 && h->composites >= 0 && h->distances >= 0 && h->angles >= 0 && h->pins >= 0;
+		
+		int i;
+		for (i=0; valid && i<SNAPSHOT_ARRAYS; i++) {
+			size_t count, bytes;
+			snapshotExtent(*h, (SnapshotArray)i, count, bytes);
+			valid = h->offsets[i] % 8 == 0 && h->offsets[i] <= size && count*bytes <= size - h->offsets[i];
+		}
+		
+		if (!valid)
+			close();
+		return valid;
+	}
+	
+	void close() {
+		if (data)
+			munmap(data, size);
+		data = NULL;
+		size = 0;
+	}
+	
+	~Snapshot() {
+		close();
+	}
+};
+
+// writes every composite of the world, false on I/O errors or when a composite
+// holds a constraint type the format can not describe, or relaxes constraints
+// kept outside its list (GridCloth)
+inline bool saveSnapshot(VerletJS& sim, const char* path) {
+	SnapshotHeader h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, snapshotMagic, 4);
+	h.version = snapshotVersion;
+	h.width = sim.width;
+	h.height = sim.height;
+	h.gravityX = sim.gravity.x;
+	h.gravityY = sim.gravity.y;
+	h.friction = sim.friction;
+	h.groundFriction = sim.groundFriction;
+	h.fixedStep = sim.fixedStep;
+	h.maxSubsteps = sim.maxSubsteps;
+	h.collisions = sim.collisions;
+	h.seed = sim.seed;
+	h.random = sim.random.state;
+	
+	vector<SnapshotComposite> composites;
+	vector<int32_t> da, db, aa, ab, ac, pa;
+	vector<float> dd, ds, dt, aw, as, px, py;
+	
+	int c, i;
+	for (c=0; c<sim.composites.size(); c++) {
+		Composite* composite = sim.composites[c];
+		if (composite->constraintCount() != composite->constraints.size())
+			return false;
+		
+		SnapshotComposite record;
+		memset(&record, 0, sizeof(record));
+		record.first = composite->begin();
+		record.particles = (int)composite->particles.size();
+		record.selfCollision = composite->selfCollision;
+		
+		// removals swap within the batch, so the distances are written in the order
+		// they relax and the restored world, which builds its batch from the file,
+		// steps as this one does
+		Constraints& constraints = composite->constraints;
+		DistanceBatch& batch = composite->batches.distances;
+		bool batched = !composite->dirty && !batch.colored();
+		vector<DistanceConstraint*> distances;
+		for (i=0; i<constraints.size(); i++)
+			if (constraints[i]->type & Constraint::DISTANCE)
+				distances.push_back(static_cast<DistanceConstraint*>(constraints[i]));
+		if (batched)
+			distances.assign(batch.constraints.begin(), batch.constraints.end());
+		
+		for (i=0; i<distances.size(); i++) {
+			DistanceConstraint* d = distances[i];
+			da.push_back(d->a->index);
+			db.push_back(d->b->index);
+			dd.push_back(d->distance);
+			ds.push_back(d->stiffness);
+			dt.push_back(d->tear);
+			record.distances++;
+		}
+		
+		for (i=0; i<constraints.size(); i++) {
+			Constraint* constraint = constraints[i];
+			if (constraint->type & Constraint::DISTANCE) {
+				continue;
+			} else if (constraint->type & Constraint::ANGLE) {
+				AngleConstraint* a = static_cast<AngleConstraint*>(constraint);
+				aa.push_back(a->a->index);
+				ab.push_back(a->b->index);
+				ac.push_back(a->c->index);
+				aw.push_back(a->angle);
+				as.push_back(a->stiffness);
+				record.angles++;
+			} else if (constraint->type & Constraint::PIN) {
+				PinConstraint* p = static_cast<PinConstraint*>(constraint);
+				pa.push_back(p->a->index);
+				px.push_back(p->pos.x);
+				py.push_back(p->pos.y);
+				record.pins++;
+			} else {
+				return false;
+			}
+		}
+		
+		composites.push_back(record);
+	}
+	
+	h.particles = sim.store.size();
+	h.composites = (int)composites.size();
+	h.distances = (int)da.size();
+	h.angles = (int)aa.size();
+	h.pins = (int)pa.size();
+	
+	const void* arrays[SNAPSHOT_ARRAYS] = {
+		sim.store.x.data(), sim.store.y.data(), sim.store.lastX.data(), sim.store.lastY.data(), sim.store.radius.data(),
+		composites.data(),
+		da.data(), db.data(), dd.data(), ds.data(), dt.data(),
+		aa.data(), ab.data(), ac.data(), aw.data(), as.data(),
+		pa.data(), px.data(), py.data()
+	};
+	
+	size_t sizes[SNAPSHOT_ARRAYS];
+	uint64_t offset = (sizeof(h) + 7) & ~7;
+	for (i=0; i<SNAPSHOT_ARRAYS; i++) {
+		size_t count, bytes;
+		snapshotExtent(h, (SnapshotArray)i, count, bytes);
+		sizes[i] = count*bytes;
+		h.offsets[i] = offset;
+		offset = (offset + sizes[i] + 7) & ~7;
+	}
+	
+	FILE* f = fopen(path, "wb");
+	if (!f)
+		return false;
+	
+	static const char padding[8] = {0};
+	bool ok = fwrite(&h, sizeof(h), 1, f) == 1;
+	uint64_t written = sizeof(h);
+	for (i=0; ok && i<SNAPSHOT_ARRAYS; i++) {
+		ok = fwrite(padding, 1, h.offsets[i] - written, f) == h.offsets[i] - written;
+		if (ok && sizes[i])
+			ok = fwrite(arrays[i], sizes[i], 1, f) == 1;
+		written = h.offsets[i] + sizes[i];
+	}
+	
+	return fclose(f) == 0 && ok;
+}
+
+// builds a new world from a snapshot, NULL if the file is not a valid snapshot
+inline VerletJS* loadSnapshot(Snapshot& snapshot) {
+	SnapshotHeader* h = snapshot.header();
+	if (!h)
+		return NULL;
+	
+	VerletJS* sim = new VerletJS(h->width, h->height, h->seed);
+	sim->random.state = h->random;
+	sim->gravity = Vec2(h->gravityX, h->gravityY);
+	sim->friction = h->friction;
+	sim->groundFriction = h->groundFriction;
+	sim->fixedStep = h->fixedStep;
+	sim->maxSubsteps = h->maxSubsteps;
+	sim->collisions = h->collisions != 0;
+	
+	// particle state is copied in bulk
+	int n = h->particles;
+	ParticleStore& store = sim->store;
+	store.x.assign(snapshot.array<float>(SNAPSHOT_X), snapshot.array<float>(SNAPSHOT_X) + n);
+	store.y.assign(snapshot.array<float>(SNAPSHOT_Y), snapshot.array<float>(SNAPSHOT_Y) + n);
+	store.lastX.assign(snapshot.array<float>(SNAPSHOT_LAST_X), snapshot.array<float>(SNAPSHOT_LAST_X) + n);
+	store.lastY.assign(snapshot.array<float>(SNAPSHOT_LAST_Y), snapshot.array<float>(SNAPSHOT_LAST_Y) + n);
+	store.radius.assign(snapshot.array<float>(SNAPSHOT_RADIUS), snapshot.array<float>(SNAPSHOT_RADIUS) + n);
+	store.handles.assign(n, NULL);
+	store.pins.assign(n, NULL);
+	
+	const SnapshotComposite* records = snapshot.array<SnapshotComposite>(SNAPSHOT_COMPOSITES);
+	const int32_t* da = snapshot.array<int32_t>(SNAPSHOT_DISTANCE_A);
+	const int32_t* db = snapshot.array<int32_t>(SNAPSHOT_DISTANCE_B);
+	const float* dd = snapshot.array<float>(SNAPSHOT_DISTANCE);
+	const float* ds = snapshot.array<float>(SNAPSHOT_DISTANCE_STIFFNESS);
+	const float* dt = snapshot.array<float>(SNAPSHOT_DISTANCE_TEAR);
+	const int32_t* aa = snapshot.array<int32_t>(SNAPSHOT_ANGLE_A);
+	const int32_t* ab = snapshot.array<int32_t>(SNAPSHOT_ANGLE_B);
+	const int32_t* ac = snapshot.array<int32_t>(SNAPSHOT_ANGLE_C);
+	const float* aw = snapshot.array<float>(SNAPSHOT_ANGLE);
+	const float* as = snapshot.array<float>(SNAPSHOT_ANGLE_STIFFNESS);
+	const int32_t* pa = snapshot.array<int32_t>(SNAPSHOT_PIN_A);
+	const float* px = snapshot.array<float>(SNAPSHOT_PIN_X);
+	const float* py = snapshot.array<float>(SNAPSHOT_PIN_Y);
+	
+	// every particle gets its handle before any constraint refers to it
+	vector<Particle*> handles(n, (Particle*)NULL);
+	
+	int c, i, d = 0, a = 0, p = 0;
+	bool valid = true;
+	for (c=0; valid && c<h->composites; c++) {
+		SnapshotComposite r = records[c];
+		valid = r.first >= 0 && r.particles >= 0 && r.first <= n - r.particles;
+		if (!valid)
+			break;
+		
+		Composite* composite = new Composite(&store);
+		composite->first = r.first;
+		composite->selfCollision = r.selfCollision != 0;
+		composite->particles.reserve(r.particles);
+		composite->arena.reserve(r.particles*sizeof(Particle));
+		for (i=0; i<r.particles; i++) {
+			Particle* particle = composite->make<Particle>(&store, r.first+i);
+			composite->particles.push_back(particle);
+			handles[r.first+i] = particle;
+		}
+		sim->composites.push_back(composite);
+	}
+	
+	for (c=0; valid && c<h->composites; c++) {
+		SnapshotComposite r = records[c];
+		Composite* composite = sim->composites[c];
+		
+		valid = r.distances >= 0 && r.angles >= 0 && r.pins >= 0 &&
+			d + r.distances <= h->distances && a + r.angles <= h->angles && p + r.pins <= h->pins;
+		if (!valid)
+			break;
+		
+		composite->constraints.reserve(r.distances + r.angles + r.pins);
+		composite->arena.reserve(r.distances*sizeof(DistanceConstraint) + r.angles*sizeof(AngleConstraint) + r.pins*sizeof(PinConstraint));
+		
+		for (i=0; valid && i<r.distances; i++, d++) {
+			valid = da[d] >= 0 && da[d] < n && handles[da[d]] && db[d] >= 0 && db[d] < n && handles[db[d]];
+			if (valid) {
+				DistanceConstraint* constraint = composite->make<DistanceConstraint>(handles[da[d]], handles[db[d]], ds[d], dd[d]);
+				constraint->tear = dt[d];
+				composite->constraints.push_back(constraint);
+			}
+		}
+		
+		for (i=0; valid && i<r.angles; i++, a++) {
+			valid = aa[a] >= 0 && aa[a] < n && handles[aa[a]] && ab[a] >= 0 && ab[a] < n && handles[ab[a]] && ac[a] >= 0 && ac[a] < n && handles[ac[a]];
+			if (valid)
+				composite->constraints.push_back(composite->make<AngleConstraint>(handles[aa[a]], handles[ab[a]], handles[ac[a]], as[a], aw[a]));
+		}
+		
+		for (i=0; valid && i<r.pins; i++, p++) {
+			valid = pa[p] >= 0 && pa[p] < n && handles[pa[p]];
+			if (valid)
+				composite->constraints.push_back(composite->make<PinConstraint>(handles[pa[p]], Vec2(px[p], py[p])));
+		}
+	}
+	
+	if (!valid) {
+		delete sim;
+		return NULL;
+	}
+	
+	return sim;
+}
+
+inline VerletJS* loadSnapshot(const char* path) {
+	Snapshot snapshot;
+	if (!snapshot.open(path))
+		return NULL;
+	return loadSnapshot(snapshot);
+}
+
+// a world of plain composites steps after a round trip exactly as it does without
+// one; truncated, corrupt and other version files are rejected
+void test_Snapshot() {
+	const char* path = "/tmp/verletc-snapshot-test";
+	
+	VerletJS sim(800, 500, 42);
+	Vec2 vertices[] = {Vec2(20,10), Vec2(40,10), Vec2(60,10), Vec2(80,10), Vec2(100,10)};
+	Composite* segment = new LineSegments(&sim, vertices, 0.02);
+	segment->pin(0);
+	segment->pin(4);
+	new Tire(&sim, Vec2(200,50), 50, 30, 0.3, 0.9);
+	new Tree(&sim, Vec2(720,380), 4, 70, 0.95, (M_PI/2)/3);
+	Cloth* cloth = new Cloth(&sim, Vec2(400,200), 200, 200, 12, 4, 0.9);
+	cloth->tear(1.1);
+	
+	int i;
+	for (i=0; i<30; i++)
+		sim.update(1.0f/60);
+	sim.random.next();
+	
+	bool saved = saveSnapshot(sim, path);
+	VerletJS* restored = loadSnapshot(path);
+	bool loaded = restored && restored->seed == sim.seed && restored->random.state == sim.random.state;
+	
+	// the cloth is pulled down by a bottom corner until links tear
+	int links = cloth->constraints.size();
+	Vec2 corner = cloth->particles.back()->getPos();
+	sim.onMouseClick(0, true, corner.x, corner.y);
+	if (loaded)
+		restored->onMouseClick(0, true, corner.x, corner.y);
+	
+	bool identical = loaded;
+	for (i=0; identical && i<60; i++) {
+		sim.onMouseMove(corner.x + i*2, corner.y + i*4);
+		restored->onMouseMove(corner.x + i*2, corner.y + i*4);
+		sim.update(1.0f/60);
+		restored->update(1.0f/60);
+		identical = sim.stateHash() == restored->stateHash();
+	}
+	bool tore = cloth->constraints.size() < links;
+	delete restored;
+	
+	// the file, then damaged copies of it
+	vector<char> file;
+	FILE* f = fopen(path, "rb");
+	if (f) {
+		char buffer[4096];
+		size_t n;
+		while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+			file.insert(file.end(), buffer, buffer+n);
+		fclose(f);
+	}
+	
+	auto rejects = [&](vector<char> bytes) {
+		FILE* f = fopen(path, "wb");
+		if (!f)
+			return false;
+		fwrite(bytes.data(), 1, bytes.size(), f);
+		fclose(f);
+		
+		VerletJS* world = loadSnapshot(path);
+		bool rejected = world == NULL;
+		delete world;
+		return rejected;
+	};
+	
+	bool rejected = file.size() > sizeof(SnapshotHeader);
+	if (rejected) {
+		SnapshotHeader h;
+		memcpy(&h, file.data(), sizeof(h));
+		
+		rejected &= rejects(vector<char>(file.begin(), file.begin() + file.size()/2));
+		rejected &= rejects(vector<char>(file.begin(), file.begin() + sizeof(SnapshotHeader)/2));
+		
+		vector<char> corrupt = file;
+		corrupt[0] = 'X';
+		rejected &= rejects(corrupt);
+		
+		corrupt = file;
+		((SnapshotHeader*)corrupt.data())->version = snapshotVersion+1;
+		rejected &= rejects(corrupt);
+		
+		corrupt = file;
+		((SnapshotHeader*)corrupt.data())->offsets[SNAPSHOT_PIN_Y] = file.size();
+		rejected &= rejects(corrupt);
+		
+		// a constraint that refers to a particle out of the store
+		corrupt = file;
+		((int32_t*)(corrupt.data() + h.offsets[SNAPSHOT_DISTANCE_B]))[h.distances-1] = h.particles;
+		rejected &= rejects(corrupt);
+		
+		// composites that announce more constraints than there are
+		corrupt = file;
+		((SnapshotComposite*)(corrupt.data() + h.offsets[SNAPSHOT_COMPOSITES]))[0].angles = h.angles+1;
+		rejected &= rejects(corrupt);
+	}
+	remove(path);
+	
+	// a grid cloth relaxes links the format can not hold
+	VerletJS grid(800, 500);
+	new GridCloth<>(&grid, Vec2(400,200), 200, 200, 12, 4, 0.9);
+	bool refused = !saveSnapshot(grid, path);
+	remove(path);
+	
+	cout << "Snapshot: " << (saved && loaded && identical && tore && rejected && refused ? "PASS" : "FAIL") << "\n";
+}
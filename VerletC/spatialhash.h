@@ -0,0 +1,131 @@
+// SpatialHash -- uniform grid over a range of the particle store, hashed into a
+// table of buckets and rebuilt with a counting sort, for radius queries.
+
+#pragma once
+
+#include "vec2.h"
+
+#include <vector>
+#include <algorithm>
+#include <math.h>
+
+using namespace std;
+
+struct SpatialHash {
+	float cellSize = 1;
+	int mask = 0;
+	
+	// particles of bucket k are entries[start[k]] .. entries[start[k+1]-1]
+	vector<int> start;
+	vector<int> entries;
+	vector<int> bucketOf;
+	
+	// buckets seen by the running query, kept to reuse its memory
+	vector<int> visited;
+	
+	int cell(float v) {
+		return (int)floorf(v/cellSize);
+	}
+	
+	// neighboring cells of a row land in neighboring buckets, which keeps
+	// scans over adjacent cells in cache
+	int bucket(int cx, int cy) {
+		return ((unsigned)cx + (unsigned)cy*19349663u) & mask;
+	}
+	
+	int size() {
+		return (int)entries.size();
+	}
+	
+	// indexes particles [begin, end), cellSize should be about the query radius
+	void build(const float* x, const float* y, int begin, int end, float cellSize) {
+		build(x, y, begin, end, NULL, cellSize);
+	}
+	
+	// indexes the n particles listed in indices
+	void build(const float* x, const float* y, const int* indices, int n, float cellSize) {
+		build(x, y, 0, n, indices, cellSize);
+	}
+	
+	// particles indices[begin..end) or begin..end when indices is NULL
+	void build(const float* x, const float* y, int begin, int end, const int* indices, float cellSize) {
+		int i, n = end-begin;
+		
+		this->cellSize = cellSize;
+		
+		int buckets = 16;
+		while (buckets < 2*n)
+			buckets <<= 1;
+		mask = buckets-1;
+		
+		start.assign(buckets+1, 0);
+		entries.resize(n);
+		bucketOf.resize(n);
+		
+		for (i=0; i<n; i++) {
+			int p = indices ? indices[begin+i] : begin+i;
+			int k = bucket(cell(x[p]), cell(y[p]));
+			bucketOf[i] = k;
+			start[k+1]++;
+		}
+		
+		for (i=0; i<buckets; i++)
+			start[i+1] += start[i];
+		
+		// start[k] is used as the fill cursor of bucket k and ends up at start[k+1],
+		// shifting it back restores the bucket offsets
+		for (i=0; i<n; i++)
+			entries[start[bucketOf[i]]++] = indices ? indices[begin+i] : begin+i;
+		
+		for (i=buckets; i>0; i--)
+			start[i] = start[i-1];
+		start[0] = 0;
+	}
+	
+	// calls fn(index) once for every particle in the cells overlapping the circle,
+	// candidates still have to be tested against the actual distance; fn must not
+	// query the same hash
+	template<typename F>
+	void query(Vec2 p, float radius, F fn) {
+		if (entries.empty())
+			return;
+		
+		int x0 = cell(p.x-radius), x1 = cell(p.x+radius);
+		int y0 = cell(p.y-radius), y1 = cell(p.y+radius);
+		
+		// several cells may share a bucket, visit each bucket once
+		visited.clear();
+		
+		int cx, cy, i;
+		for (cy=y0; cy<=y1; cy++) {
+			for (cx=x0; cx<=x1; cx++) {
+				int k = bucket(cx, cy);
+				if (find(visited.begin(), visited.end(), k) != visited.end())
+					continue;
+				visited.push_back(k);
+				
+				for (i=start[k]; i<start[k+1]; i++)
+					fn(entries[i]);
+			}
+		}
+	}
+	
+	// closest particle within radius of p, lowest index on ties, -1 if none.
+	// drift is how far particles may have moved since the hash was built
+	int nearest(const float* x, const float* y, Vec2 p, float radius, float drift = 0) {
+		int best = -1;
+		float bestD2 = radius*radius;
+		
+		query(p, radius + drift, [&](int i) {
+			float dx = x[i] - p.x;
+			float dy = y[i] - p.y;
+			float d2 = dx*dx + dy*dy;
+			if (d2 < bestD2 || (d2 == bestD2 && (best < 0 || i < best))) {
+				best = i;
+				bestD2 = d2;
+			}
+		});
+		
+		return best;
+	}
+};
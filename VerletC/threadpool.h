@@ -0,0 +1,135 @@
+// ThreadPool -- a fixed set of worker threads that help run parallel loops.
+// The calling thread always takes part in its own loop and only waits for the
+// chunks other threads already picked up, so loops may be nested safely.
+
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+struct ThreadPool {
+	struct Job {
+		function<void(int, int)> fn;
+		int end;
+		int grain;
+		atomic<int> next;
+		atomic<int> users;
+		
+		bool available() {
+			return next.load() < end;
+		}
+		
+		// runs chunks until the range is exhausted
+		void run() {
+			int begin;
+			while ((begin = next.fetch_add(grain)) < end)
+				fn(begin, min(begin+grain, end));
+		}
+	};
+	
+	vector<thread> workers;
+	vector<Job*> jobs;
+	mutex lock;
+	condition_variable wake;
+	bool stop = false;
+	
+	// threads: total number of threads taking part in a loop, including the caller
+	ThreadPool(int threads = thread::hardware_concurrency()) {
+		int i;
+		for (i=1; i<threads; i++)
+			workers.push_back(thread(&ThreadPool::work, this));
+	}
+	
+	int size() {
+		return (int)workers.size() + 1;
+	}
+	
+	// calls fn(chunkBegin, chunkEnd) over [begin, end) in chunks of grain, returns when all are done
+	void parallelFor(int begin, int end, int grain, function<void(int, int)> fn) {
+		if (grain < 1)
+			grain = 1;
+		
+		if (workers.empty() || end-begin <= grain) {
+			if (begin < end)
+				fn(begin, end);
+			return;
+		}
+		
+		Job job;
+		job.fn = fn;
+		job.end = end;
+		job.grain = grain;
+		job.next = begin;
+		job.users = 0;
+		
+		{
+			unique_lock<mutex> l(lock);
+			jobs.push_back(&job);
+		}
+		wake.notify_all();
+		
+		job.run();
+		
+		{
+			unique_lock<mutex> l(lock);
+			jobs.erase(find(jobs.begin(), jobs.end(), &job));
+		}
+		
+		// wait for chunks still running on other threads
+		while (job.users.load() > 0)
+			this_thread::yield();
+	}
+	
+	void work() {
+		while (true) {
+			Job* job = NULL;
+			{
+				unique_lock<mutex> l(lock);
+				wake.wait(l, [this, &job] {
+					// the most recent job first, so that nested loops finish early
+					int i;
+					for (i=(int)jobs.size()-1; i>=0; i--) {
+						if (jobs[i]->available()) {
+							job = jobs[i];
+							break;
+						}
+					}
+					return stop || job;
+				});
+				
+				if (!job)
+					return;
+				
+				job->users++;
+			}
+			
+			job->run();
+			job->users--;
+		}
+	}
+	
+	// pool shared by every world that does not bring its own
+	static ThreadPool& shared() {
+		static ThreadPool pool;
+		return pool;
+	}
+	
+	~ThreadPool() {
+		{
+			unique_lock<mutex> l(lock);
+			stop = true;
+		}
+		wake.notify_all();
+		
+		int i;
+		for (i=0; i<workers.size(); i++)
+			workers[i].join();
+	}
+};
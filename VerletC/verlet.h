@@ -25,6 +25,12 @@
 #pragma once
 
 #include "composite.h"
+#include "integrate.h"
+#include "spatialhash.h"
+#include "collision.h"
+#include "recorder.h"
+#include "random.h"
+#include "replay.h"
 
 using namespace std;
 
@@ -35,147 +41,796 @@ struct VerletJS {
 	Vec2 mousePos = Vec2(0,0);
 	bool mouseDown = false;
 	Draggable* draggedEntity = NULL;
+	int draggedParticle = -1;
 	float selectionRadius = 20.0f;
-	GLubyte highlightColor[3] = { 0x4F, 0x54, 0x5C };
+	Color highlightColor = Color(0x4F, 0x54, 0x5C);
 	
 	// simulation params
 	Vec2 gravity = Vec2(0,0.2);
 	float friction = 0.99;
 	float groundFriction = 0.8;
 	
+	// SOLVER_SERIAL relaxes in insertion order, SOLVER_COLORED groups distance and
+	// angle constraints by graph coloring and relaxes each color in parallel on the pool
+	enum Solver {
+		SOLVER_SERIAL,
+		SOLVER_COLORED
+	};
+	
+	Solver solver = SOLVER_SERIAL;
+	
+	// NULL uses ThreadPool::shared()
+	ThreadPool* pool = NULL;
+	
+	// adaptive relaxation: instead of always running step iterations, each
+	// composite is relaxed until an iteration moves none of its particles by more
+	// than tolerance, running at least minIterations and at most step iterations.
+	// With collisions the composites and contacts iterate together and stop together
+	bool adaptive = false;
+	float tolerance = 0.01f;
+	int minIterations = 2;
+	
+	// largest number of iterations a composite ran in the last step, the count
+	// of each composite is in Composite::iterations
+	int iterations = 0;
+	
+	// sleeping: a composite whose kinetic energy -- the mean squared distance its
+	// particles moved in a step -- stays at most sleepEnergy for sleepSteps steps
+	// in a row falls asleep together with the composites coupled to it (the groups
+	// of groupComposites()) and is skipped by update() until it is dragged, hit
+	// by an awake composite, invalidated, or gravity, friction or the world size
+	// change. Sleeping particles still take part in finding contacts
+	bool sleep = false;
+	float sleepEnergy = 0.0001f;
+	int sleepSteps = 60;
+	
+	// the parameters when the sleep state was last checked, and whether sleep was on
+	bool sleepCoupled = false;
+	bool slept = false;
+	float sleepParams[6] = {0};
+	
+	// runs every group of composites coupled by constraints as a task on the pool,
+	// composites of a group and the stages of each composite keep their order
+	bool parallelComposites = false;
+	
+	// composites of group g are groupMembers[groupStart[g]] .. groupMembers[groupStart[g+1]-1]
+	vector<int> groupStart;
+	vector<int> groupMembers;
+	vector<float> groupWeights;
+	vector<int> groupOrder;
+	vector<int> groupParent;
+	vector<int> groupOf;
+	vector<int> owner;
+	
+	// what the groups were built from, see regroup()
+	int groupedComposites = -1;
+	int groupedParticles = -1;
+	int groupedConstraints = -1;
+	int groupedRevision = -1;
+	int groupedStep = -1;
+	bool grouped = false;
+	
+	// contacts between particles with a radius, see Composite::setRadius
+	bool collisions = false;
+	Collisions contacts;
+	
+	// fixed-step mode, see advance(); 0 steps by whatever time each frame took
+	float fixedStep = 0;
+	
+	// steps run by one advance() at most, the rest of the time is dropped so
+	// that a slow frame can not make the next one slower
+	int maxSubsteps = 5;
+	
+	// time not yet simulated, and how far draw() is between the last two steps
+	float accumulator = 0;
+	float alpha = 1;
+	
+	// every random choice of the scene and its composites comes from random,
+	// seeded with seed when the world is created
+	uint64_t seed;
+	Random random;
+	
+	// records steps and input when set, see replay(); set it before the first step
+	ReplayLog* replayLog = NULL;
+	
+	// receives the positions after every step when set and open
+	TrajectoryRecorder* recorder = NULL;
+	
+	// holds the state of every particle in the world
+	ParticleStore store;
+	
+	// interpolated positions swapped into the store while drawing
+	vector<float> drawX;
+	vector<float> drawY;
+	
 	// holds composite entities
 	Composites composites;
 	
-	VerletJS(int width, int height): width(width), height(height) {}
+	// grid used by nearestEntity. Particles drift away from their cells as the
+	// world steps; queries reach pickDrift further, and the grid is rebuilt only
+	// once that exceeds selectionRadius. Set pickDirty after moving particles
+	// outside a step.
+	SpatialHash pickHash;
+	float pickDrift = 0;
+	bool pickDirty = true;
 	
-	void bounds(Particle *particle) {
-		if (particle->pos.y > height-1)
-			particle->pos.y = height-1;
-		
-		if (particle->pos.x < 0)
-			particle->pos.x = 0;
-		
-		if (particle->pos.x > width-1)
-			particle->pos.x = width-1;
+	VerletJS(int width, int height, uint64_t seed = 1): width(width), height(height), seed(seed), random(seed) {}
+	
+	// also finds how far the particles moved in the step, for the pick grid
+	void bounds(Composite* composite) {
+		PROFILE_SCOPE(PROFILE_BOUNDS);
+		float* x = store.x.data();
+		float* y = store.y.data();
+		float* lastX = store.lastX.data();
+		float* lastY = store.lastY.data();
+		float moved = 0;
+		int i;
+		for (i=composite->begin(); i<composite->end(); i++) {
+			if (y[i] > height-1)
+				y[i] = height-1;
+			
+			if (x[i] < 0)
+				x[i] = 0;
+			
+			if (x[i] > width-1)
+				x[i] = width-1;
+			
+			float dx = x[i]-lastX[i];
+			float dy = y[i]-lastY[i];
+			moved = fmaxf(moved, dx*dx + dy*dy);
+		}
+		composite->moved = sqrtf(moved);
 	}
 	
-	Draggable* nearestEntity() {
-		int c, i;
-		float d2Nearest = 0.0f;
-		Draggable* entity = NULL;
-		Constraints* constraintsNearest = NULL;
-		
-		// find nearest point
-		for (c = 0; c < composites.size(); c++) {
-			Particles& particles = composites[c]->particles;
-			for (i = 0; i < particles.size(); i++) {
-				float d2 = particles[i]->pos.dist2(mousePos);
-				if (d2 <= selectionRadius*selectionRadius && (entity == NULL || d2 < d2Nearest)) {
-					entity = particles[i];
-					constraintsNearest = &(composites[c]->constraints);
-					d2Nearest = d2;
-				}
-			}
+	void integrate(int begin, int end, float dt) {
+		PROFILE_SCOPE(PROFILE_INTEGRATE);
+		IntegrateParams p;
+		p.friction = friction;
+		p.groundFriction = groundFriction;
+		p.ground = height-1;
+		p.gx = gravity.x*60.0f*dt;
+		p.gy = gravity.y*60.0f*dt;
+		integrateParticles(store.x.data(), store.y.data(), store.lastX.data(), store.lastY.data(), begin, end, p);
+	}
+	
+	// index of the particle closest to the mouse, -1 if none is within selectionRadius
+	int nearestParticle() {
+		PROFILE_SCOPE(PROFILE_PICK);
+		if (pickDirty || pickDrift > selectionRadius || pickHash.size() != store.size()) {
+			pickHash.build(store.x.data(), store.y.data(), 0, store.size(), selectionRadius);
+			pickDrift = 0;
+			pickDirty = false;
 		}
 		
-		// search for pinned constraints for this entity
-		if (constraintsNearest) {
-			Constraints& constraints = *constraintsNearest;
-			for (i = 0; i < constraints.size(); i++) {
-				if (constraints[i]->type & Constraint::PIN && static_cast<PinConstraint*>(constraints[i])->a == entity)
-					entity = static_cast<Draggable*>(static_cast<PinConstraint*>(constraints[i]));
-			}
-		}
-		return entity;
+		return pickHash.nearest(store.x.data(), store.y.data(), mousePos, selectionRadius, pickDrift);
 	}
 	
-	void onMouseClick( int button, int state, int x, int y ) {
+	// pinned particles are dragged through their pin
+	Draggable* entity(int i) {
+		if (i < 0)
+			return NULL;
+		return store.pins[i] ? store.pins[i] : store.handles[i];
+	}
+	
+	Draggable* nearestEntity() {
+		return entity(nearestParticle());
+	}
+	
+	void onMouseClick( int button, bool down, int x, int y ) {
+		logEvent(ReplayEvent::MOUSE_CLICK, button, down, x, y);
 		mousePos.x = x;
 		mousePos.y = y;
-		if (state == GLUT_DOWN) {
+		if (down) {
 			mouseDown = true;
-			Draggable* nearest = nearestEntity();
-			if (nearest)
-				draggedEntity = nearest;
+			int i = nearestParticle();
+			if (i >= 0) {
+				draggedEntity = entity(i);
+				draggedParticle = i;
+			}
 		} else {
 			mouseDown = false;
 			draggedEntity = NULL;
+			draggedParticle = -1;
 		}
 	};
 	
 	void onMouseMove( int x, int y ) {
+		logEvent(ReplayEvent::MOUSE_MOVE, 0, false, x, y);
 		mousePos.x = x;
 		mousePos.y = y;
 	};
 	
-	void update(float dt, int step = 16) {
-		int i, j, c;
+	void logEvent(ReplayEvent::Type type, int button, bool down, int x, int y) {
+		if (!replayLog)
+			return;
 		
-		for (c = 0; c < composites.size(); c++) {
-			composites[c]->update(dt);
+		ReplayEvent e;
+		e.step = (int)replayLog->steps.size();
+		e.type = type;
+		e.button = button;
+		e.down = down;
+		e.x = x;
+		e.y = y;
+		replayLog->events.push_back(e);
+	}
+	
+	// cheap fingerprint of the particle state, positions and previous positions
+	uint64_t stateHash() {
+		uint64_t h = 0xCBF29CE484222325ull;
+		int n = store.size();
+		h = hashWords(h, store.x.data(), n);
+		h = hashWords(h, store.y.data(), n);
+		h = hashWords(h, store.lastX.data(), n);
+		h = hashWords(h, store.lastY.data(), n);
+		return h;
+	}
+	
+	// runs the steps and input of a log again on a world built the same way and with
+	// the same seed, returns the first step whose state hash differs or -1
+	int replay(ReplayLog& log) {
+		ReplayLog* recording = replayLog;
+		replayLog = NULL;
+		
+		solver = (Solver)log.solver;
+		collisions = log.collisions != 0;
+		adaptive = log.adaptive != 0;
+		minIterations = log.minIterations;
+		tolerance = log.tolerance;
+		sleep = log.sleep != 0;
+		sleepSteps = log.sleepSteps;
+		sleepEnergy = log.sleepEnergy;
+		
+		int s, e = 0, diverged = -1;
+		for (s=0; s<log.steps.size(); s++) {
+			for (; e<log.events.size() && log.events[e].step <= s; e++) {
+				ReplayEvent& event = log.events[e];
+				if (event.type == ReplayEvent::MOUSE_CLICK)
+					onMouseClick(event.button, event.down != 0, event.x, event.y);
+				else
+					onMouseMove(event.x, event.y);
+			}
 			
-			for (i = 0; i < composites[c]->particles.size(); i++) {
-				Particles& particles = composites[c]->particles;
-				
-				// calculate velocity
-				Vec2 velocity = (particles[i]->pos-particles[i]->lastPos)*friction;
-				
-				// ground friction
-				if (particles[i]->pos.y >= height-1 && velocity.length2() > 0.000001) {
-					float m = velocity.length();
-					velocity.x /= m;
-					velocity.y /= m;
-					velocity *= m*groundFriction;
+			update(log.steps[s].dt, log.steps[s].iterations);
+			
+			if (stateHash() != log.steps[s].hash) {
+				diverged = s;
+				break;
+			}
+		}
+		
+		replayLog = recording;
+		return diverged;
+	}
+	
+	int findGroup(int c) {
+		while (groupParent[c] != c)
+			c = groupParent[c] = groupParent[groupParent[c]];
+		return c;
+	}
+	
+	void joinGroups(int c, int particle) {
+		if (particle < 0 || particle >= owner.size() || owner[particle] < 0)
+			return;
+		int a = findGroup(c), b = findGroup(owner[particle]);
+		if (a != b)
+			groupParent[max(a, b)] = min(a, b);
+	}
+	
+	// groupComposites() again only when composites, particles or constraints were
+	// added or removed, a composite's revision moved, or the iterations changed the
+	// weights; the counts alone miss an endpoint moved to another composite
+	bool regroup(int step) {
+		int c, constraints = 0, revision = 0;
+		for (c=0; c<composites.size(); c++) {
+			constraints += (int)composites[c]->constraints.size();
+			revision += composites[c]->revision;
+		}
+		
+		if (groupedComposites != composites.size() || groupedParticles != store.size() || groupedConstraints != constraints || groupedRevision != revision || groupedStep != step) {
+			grouped = groupComposites(step);
+			groupedComposites = (int)composites.size();
+			groupedParticles = store.size();
+			groupedConstraints = constraints;
+			groupedRevision = revision;
+			groupedStep = step;
+		}
+		return grouped;
+	}
+	
+	// splits the composites into groups that reach no particle of another group through
+	// their constraints or update(), false when a constraint of unknown type prevents it
+	bool groupComposites(int step) {
+		int n = (int)composites.size();
+		int c, i;
+		
+		owner.assign(store.size(), -1);
+		groupParent.resize(n);
+		for (c=0; c<n; c++) {
+			groupParent[c] = c;
+			for (i=composites[c]->begin(); i<composites[c]->end(); i++)
+				owner[i] = c;
+		}
+		
+		for (c=0; c<n; c++) {
+			Composite* dependency = composites[c]->dependency();
+			if (dependency && dependency->end() > dependency->begin())
+				joinGroups(c, dependency->begin());
+			
+			Constraints& constraints = composites[c]->constraints;
+			for (i=0; i<constraints.size(); i++) {
+				Constraint* constraint = constraints[i];
+				if (constraint->type & Constraint::DISTANCE) {
+					DistanceConstraint* d = static_cast<DistanceConstraint*>(constraint);
+					joinGroups(c, d->a->index);
+					joinGroups(c, d->b->index);
+				} else if (constraint->type & Constraint::ANGLE) {
+					AngleConstraint* a = static_cast<AngleConstraint*>(constraint);
+					joinGroups(c, a->a->index);
+					joinGroups(c, a->b->index);
+					joinGroups(c, a->c->index);
+				} else if (constraint->type & Constraint::PIN) {
+					joinGroups(c, static_cast<PinConstraint*>(constraint)->a->index);
+				} else {
+					return false;
 				}
-				
-				// save last good state
-				particles[i]->lastPos = particles[i]->pos;
-				
-				// gravity
-				particles[i]->pos += gravity*60.0f*dt;
-				
-				// inertia
-				particles[i]->pos += velocity;
 			}
 		}
 		
+		// number the groups by their first composite, members stay in world order
+		vector<int> id(n, -1);
+		groupStart.assign(1, 0);
+		for (c=0; c<n; c++) {
+			int root = findGroup(c);
+			if (id[root] < 0) {
+				id[root] = (int)groupStart.size()-1;
+				groupStart.push_back(0);
+			}
+			groupStart[id[root]+1]++;
+		}
+		
+		int groups = (int)groupStart.size()-1;
+		for (i=0; i<groups; i++)
+			groupStart[i+1] += groupStart[i];
+		
+		// fill with a cursor per group, then shift back as in SpatialHash::build
+		groupMembers.resize(n);
+		groupOf.resize(n);
+		groupWeights.assign(groups, 0);
+		for (c=0; c<n; c++) {
+			int g = id[findGroup(c)];
+			groupOf[c] = g;
+			groupMembers[groupStart[g]++] = c;
+			groupWeights[g] += composites[c]->particles.size() + (float)composites[c]->constraintCount()*step;
+		}
+		for (i=groups; i>0; i--)
+			groupStart[i] = groupStart[i-1];
+		groupStart[0] = 0;
+		
+		// heaviest groups are dispatched first
+		groupOrder.resize(groups);
+		for (i=0; i<groups; i++)
+			groupOrder[i] = i;
+		sort(groupOrder.begin(), groupOrder.end(), [this](int a, int b) {
+			return groupWeights[a] > groupWeights[b];
+		});
+		
+		return true;
+	}
+	
+	// the whole step for one group, in the same order as the serial update
+	void updateGroup(int g, float dt, int step, ThreadPool* relaxPool) {
+		int m;
+		bool dragged = false;
+		
+		// a group sleeps as a whole
+		if (composites[groupMembers[groupStart[g]]]->sleeping)
+			return;
+		
+		for (m=groupStart[g]; m<groupStart[g+1]; m++) {
+			Composite* composite = composites[groupMembers[m]];
+			composite->update(dt);
+			integrate(composite->begin(), composite->end(), dt);
+			dragged |= draggedParticle >= composite->begin() && draggedParticle < composite->end();
+		}
+		
+		if (dragged)
+			draggedEntity->setPos(mousePos);
+		
+		for (m=groupStart[g]; m<groupStart[g+1]; m++)
+			relax(composites[groupMembers[m]], step, relaxPool);
+		
+		for (m=groupStart[g]; m<groupStart[g+1]; m++)
+			bounds(composites[groupMembers[m]]);
+	}
+	
+	// wakes a composite and the composites coupled to it
+	void wake(int c) {
+		if (sleepCoupled) {
+			wakeAll();
+			return;
+		}
+		
+		int m, g = groupOf[c];
+		for (m=groupStart[g]; m<groupStart[g+1]; m++) {
+			composites[groupMembers[m]]->sleeping = false;
+			composites[groupMembers[m]]->quietSteps = 0;
+		}
+	}
+	
+	void wakeAll() {
+		int c;
+		for (c=0; c<composites.size(); c++) {
+			composites[c]->sleeping = false;
+			composites[c]->quietSteps = 0;
+		}
+	}
+	
+	int sleepingComposites() {
+		int c, n = 0;
+		for (c=0; c<composites.size(); c++)
+			n += composites[c]->sleeping;
+		return n;
+	}
+	
+	// before a step: regroups when composites or constraints were added or
+	// removed, and wakes what was invalidated or dragged, or everything when the
+	// parameters changed
+	void wakeChanged(int step) {
+		int c;
+		sleepCoupled = !regroup(step);
+		slept = true;
+		
+		float params[6] = {gravity.x, gravity.y, friction, groundFriction, (float)width, (float)height};
+		if (memcmp(params, sleepParams, sizeof(params))) {
+			memcpy(sleepParams, params, sizeof(params));
+			wakeAll();
+		}
+		
+		for (c=0; c<composites.size(); c++) {
+			if (composites[c]->changed) {
+				composites[c]->changed = false;
+				wake(c);
+			}
+		}
+		
+		if (draggedEntity && draggedParticle >= 0 && draggedParticle < owner.size() && owner[draggedParticle] >= 0)
+			wake(owner[draggedParticle]);
+	}
+	
+	// after finding contacts: a contact with an awake composite wakes a sleeping
+	// one, contacts between sleeping composites are dropped
+	void wakeContacts() {
+		vector<int>& owners = contacts.owner;
+		int i, n = contacts.size();
+		for (i=0; i<n; i++) {
+			int p = owners[contacts.a[i]], q = owners[contacts.b[i]];
+			if (p >= 0 && q >= 0 && composites[p]->sleeping != composites[q]->sleeping)
+				wake(composites[p]->sleeping ? p : q);
+		}
+		
+		int kept = 0;
+		for (i=0; i<n; i++) {
+			int p = owners[contacts.a[i]], q = owners[contacts.b[i]];
+			if (p >= 0 && q >= 0 && composites[p]->sleeping && composites[q]->sleeping)
+				continue;
+			contacts.a[kept] = contacts.a[i];
+			contacts.b[kept] = contacts.b[i];
+			contacts.distance[kept] = contacts.distance[i];
+			kept++;
+		}
+		contacts.a.resize(kept);
+		contacts.b.resize(kept);
+		contacts.distance.resize(kept);
+	}
+	
+	// after a step: counts the quiet steps of the awake composites and puts the
+	// groups whose members were all quiet long enough to sleep
+	void fallAsleep() {
+		float* x = store.x.data();
+		float* y = store.y.data();
+		float* lastX = store.lastX.data();
+		float* lastY = store.lastY.data();
+		int c, i, m, g;
+		
+		for (c=0; c<composites.size(); c++) {
+			Composite* composite = composites[c];
+			if (composite->sleeping)
+				continue;
+			
+			float energy = 0;
+			for (i=composite->begin(); i<composite->end(); i++) {
+				float vx = x[i]-lastX[i];
+				float vy = y[i]-lastY[i];
+				energy += vx*vx + vy*vy;
+			}
+			
+			int n = composite->end() - composite->begin();
+			if (n > 0 && energy > sleepEnergy*n)
+				composite->quietSteps = 0;
+			else
+				composite->quietSteps++;
+		}
+		
+		int groups = sleepCoupled ? 1 : (int)groupStart.size()-1;
+		for (g=0; g<groups; g++) {
+			int begin = sleepCoupled ? 0 : groupStart[g];
+			int end = sleepCoupled ? (int)composites.size() : groupStart[g+1];
+			
+			bool quiet = true, awake = false;
+			for (m=begin; m<end && quiet; m++) {
+				Composite* composite = composites[sleepCoupled ? m : groupMembers[m]];
+				quiet = composite->sleeping || composite->quietSteps >= sleepSteps;
+				awake |= !composite->sleeping;
+			}
+			if (!quiet || !awake)
+				continue;
+			
+			// at rest, so that they wake without velocity
+			for (m=begin; m<end; m++) {
+				Composite* composite = composites[sleepCoupled ? m : groupMembers[m]];
+				composite->sleeping = true;
+				composite->iterations = 0;
+				for (i=composite->begin(); i<composite->end(); i++) {
+					lastX[i] = x[i];
+					lastY[i] = y[i];
+				}
+			}
+		}
+	}
+	
+	// largest distance a particle in [begin, end) moved since previous was filled
+	// with their positions, refills it; an empty previous is filled without moving
+	float movement(int begin, int end, vector<float>& previous) {
+		float* x = store.x.data();
+		float* y = store.y.data();
+		int i, n = end-begin;
+		if (previous.size() != 2*n) {
+			previous.resize(2*n);
+			copy(x+begin, x+end, previous.begin());
+			copy(y+begin, y+end, previous.begin()+n);
+			return 0;
+		}
+		
+		float moved = 0;
+		for (i=0; i<n; i++) {
+			float dx = x[begin+i] - previous[i];
+			float dy = y[begin+i] - previous[n+i];
+			moved = max(moved, dx*dx + dy*dy);
+			previous[i] = x[begin+i];
+			previous[n+i] = y[begin+i];
+		}
+		return sqrtf(moved);
+	}
+	
+	// relaxes a composite step times, or with adaptive until the particles settle
+	void relax(Composite* composite, int step, ThreadPool* relaxPool) {
+		float stepCoef = 1.0f/step;
+		int i;
+		
+		if (!adaptive) {
+			composite->relax(stepCoef, step, relaxPool);
+			composite->iterations = step;
+			return;
+		}
+		
+		// groups of composites relax concurrently, so the saved positions are per thread
+		static thread_local vector<float> previous;
+		previous.clear();
+		movement(composite->begin(), composite->end(), previous);
+		
+		i = 0;
+		while (i < step) {
+			composite->relax(stepCoef, relaxPool);
+			i++;
+			if (i >= minIterations && movement(composite->begin(), composite->end(), previous) <= tolerance)
+				break;
+		}
+		composite->iterations = i;
+	}
+	
+	// constraint relaxations run by the last step
+	long long relaxations() {
+		long long n = 0;
+		int c;
+		for (c=0; c<composites.size(); c++)
+			n += (long long)composites[c]->constraintCount()*composites[c]->iterations;
+		return n;
+	}
+	
+	void update(float dt, int step = 16) {
+		PROFILE_SCOPE(PROFILE_STEP);
+		int i, c;
+		
+		ThreadPool* relaxPool = NULL;
+		if (solver == SOLVER_COLORED)
+			relaxPool = pool ? pool : &ThreadPool::shared();
+		
+		if (sleep) {
+			wakeChanged(step);
+		} else if (slept) {
+			wakeAll();
+			slept = false;
+		}
+		
+		// contacts couple every composite, and a dragged entity that belongs to no
+		// composite has no task to run in
+		bool tasks = parallelComposites && !collisions && regroup(step);
+		if (tasks && draggedEntity && (draggedParticle < 0 || draggedParticle >= owner.size() || owner[draggedParticle] < 0))
+			tasks = false;
+		
+		if (tasks) {
+			ThreadPool& threads = pool ? *pool : ThreadPool::shared();
+			threads.parallelFor(0, (int)groupOrder.size(), 1, [&](int begin, int end) {
+				int g;
+				for (g=begin; g<end; g++)
+					updateGroup(groupOrder[g], dt, step, relaxPool);
+			});
+			
+			finishStep(dt, step);
+			return;
+		}
+		
+		for (c = 0; c < composites.size(); c++) {
+			if (composites[c]->sleeping)
+				continue;
+			composites[c]->update(dt);
+			integrate(composites[c]->begin(), composites[c]->end(), dt);
+		}
+		
 		// handle dragging of entities
 		if (draggedEntity)
 			draggedEntity->setPos(mousePos);
 		
 		// relax
 		float stepCoef = 1.0f/step;
-		for (c = 0; c < composites.size(); c++) {
-			Constraints& constraints = composites[c]->constraints;
-			for (i=0;i<step;++i)
-				for (j=0; j<constraints.size(); j++)
-					constraints[j]->relax(stepCoef);
+		
+		if (collisions) {
+			// contacts couple the composites, so each iteration goes over all of them
+			{
+				PROFILE_SCOPE(PROFILE_CONTACTS);
+				contacts.find(store, composites);
+				if (sleep)
+					wakeContacts();
+			}
+			vector<float> previous;
+			if (adaptive)
+				movement(0, store.size(), previous);
+			
+			i = 0;
+			while (i < step) {
+				for (c = 0; c < composites.size(); c++)
+					if (composites[c]->constraintCount() > 0 && !composites[c]->sleeping)
+						composites[c]->relax(stepCoef, relaxPool);
+				
+				{
+					PROFILE_SCOPE(PROFILE_CONTACTS);
+					contacts.relax(store.x.data(), store.y.data());
+				}
+				
+				i++;
+				if (adaptive && i >= minIterations && movement(0, store.size(), previous) <= tolerance)
+					break;
+			}
+			for (c = 0; c < composites.size(); c++)
+				composites[c]->iterations = composites[c]->constraintCount() == 0 || composites[c]->sleeping ? 0 : i;
+		} else {
+			for (c = 0; c < composites.size(); c++)
+				if (!composites[c]->sleeping)
+					relax(composites[c], step, relaxPool);
 		}
 		
 		// bounds checking
-		for (c=0; c<composites.size(); c++) {
-			Particles& particles = composites[c]->particles;
-			for (i=0; i<particles.size(); i++)
-				bounds(particles[i]);
+		for (c=0; c<composites.size(); c++)
+			if (!composites[c]->sleeping)
+				bounds(composites[c]);
+		
+		finishStep(dt, step);
+	}
+	
+	void finishStep(float dt, int step) {
+		// sleeping composites did not move
+		float moved = 0;
+		int c;
+		for (c=0; c<composites.size(); c++)
+			if (!composites[c]->sleeping)
+				moved = fmaxf(moved, composites[c]->moved);
+		pickDrift += moved;
+		
+		// constraints that tore during the relaxation are removed once it is done
+		for (c=0; c<composites.size(); c++)
+			composites[c]->removeTorn();
+		
+		if (sleep)
+			fallAsleep();
+		
+		iterations = 0;
+		for (c=0; c<composites.size(); c++)
+			iterations = max(iterations, composites[c]->iterations);
+		
+		if (replayLog) {
+			if (replayLog->steps.empty()) {
+				replayLog->seed = seed;
+				replayLog->width = width;
+				replayLog->height = height;
+				replayLog->solver = solver;
+				replayLog->collisions = collisions;
+				replayLog->adaptive = adaptive;
+				replayLog->minIterations = minIterations;
+				replayLog->tolerance = tolerance;
+				replayLog->sleep = sleep;
+				replayLog->sleepSteps = sleepSteps;
+				replayLog->sleepEnergy = sleepEnergy;
+			}
+			
+			ReplayStep r;
+			r.dt = dt;
+			r.iterations = step;
+			r.hash = stateHash();
+			replayLog->steps.push_back(r);
 		}
+		
+		if (recorder && recorder->isOpen())
+			recorder->record(store);
 	}
 	
-	void draw() {
+	// runs as many fixed steps as fit in the frame time, returns how many; without
+	// a fixed step this is a single update(frameTime)
+	int advance(float frameTime) {
+		if (fixedStep <= 0) {
+			update(frameTime);
+			alpha = 1;
+			return 1;
+		}
+		
+		accumulator += frameTime;
+		
+		int n = 0;
+		while (accumulator >= fixedStep && n < maxSubsteps) {
+			update(fixedStep);
+			accumulator -= fixedStep;
+			n++;
+		}
+		
+		// spiral of death, keep only the fraction of a step
+		if (accumulator >= fixedStep)
+			accumulator = fmodf(accumulator, fixedStep);
+		
+		alpha = accumulator/fixedStep;
+		return n;
+	}
+	
+	void draw(Renderer& r) {
+		PROFILE_SCOPE(PROFILE_DRAW);
 		int i;
-		glEnable( GL_POINT_SMOOTH );
+		
+		// lastX/lastY hold the positions of the previous step, draw in between
+		bool interpolate = alpha < 1;
+		if (interpolate) {
+			int n = store.size();
+			drawX.resize(n);
+			drawY.resize(n);
+			for (i=0; i<n; i++) {
+				drawX[i] = store.lastX[i] + (store.x[i] - store.lastX[i])*alpha;
+				drawY[i] = store.lastY[i] + (store.y[i] - store.lastY[i])*alpha;
+			}
+			store.x.swap(drawX);
+			store.y.swap(drawY);
+		}
 		
 		for (i=0; i<composites.size(); i++) {
-			composites[i]->drawConstraints();
-			composites[i]->drawParticles();
+			composites[i]->drawConstraints(r);
+			composites[i]->drawParticles(r);
+		}
+		
+		if (interpolate) {
+			store.x.swap(drawX);
+			store.y.swap(drawY);
 		}
 		
 		// highlight nearest / dragged entity
 		Draggable* nearest = draggedEntity ? draggedEntity : nearestEntity();
-		if (nearest) {
-			glColor3ubv(highlightColor);
-			glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-			drawCircle(nearest->getPos(), 8.0f);
-		}
+		if (nearest)
+			r.circle(nearest->getPos(), 8.0f, highlightColor, false);
 	}
 	
 	~VerletJS() {
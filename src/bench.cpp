@@ -0,0 +1,444 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+
+#ifdef __APPLE__
+#include <mach/mach.h>
+#endif
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include "demo.h"
+#include "scenes.h"
+#include "gridcloth.h"
+#include "renderlist.h"
+#include "handoff.h"
+#include "snapshot.h"
+#include "batch.h"
+
+//////////////////////
+// benchmark options
+
+int steps = 1000;
+float dt = 1.0f/60.0f;
+int iterations = 16;
+float tolerance = 0;
+int min_iterations = 2;
+bool sleep_enabled = false;
+VerletJS::Solver solver = VerletJS::SOLVER_SERIAL;
+ThreadPool* pool = NULL;
+int worlds = 1;
+bool tasks = false;
+const char* record = NULL;
+const char* log_path = NULL;
+bool profile = false;
+bool sweep = false;
+long max_particles = 1000000;
+
+
+//////////////////////
+// benchmark runner
+
+void usage() {
+	printf("usage: verletc-bench [options] [scene ...]\n");
+	printf("\n");
+	printf("scenes: shapes, trees, cloth, spider (default: all)\n");
+	printf("sweep scenes: cloth, gridcloth, trees, web, tires, ropes (default: all)\n");
+	printf("\n");
+	printf("options:\n");
+	printf("  -n <steps>       number of fixed steps to run (default %d)\n", steps);
+	printf("  -dt <seconds>    step duration (default 1/60)\n");
+	printf("  -i <iterations>  relax iterations per step (default %d)\n", iterations);
+	printf("  -adaptive <tol>  stop relaxing a composite once its residual is under tol, at most -i iterations\n");
+	printf("  -min <n>         iterations run at least with -adaptive (default %d)\n", min_iterations);
+	printf("  -sleep           skip composites that came to rest until something wakes them\n");
+	printf("  -solver <name>   serial or colored (default serial)\n");
+	printf("  -threads <n>     threads used by the colored solver and by -worlds (default: all cores)\n");
+	printf("  -tasks           run each group of coupled composites as a task on the pool\n");
+	printf("  -worlds <n>      step n copies of each scene concurrently (default %d)\n", worlds);
+	printf("  -record <path>   stream the positions of every step to path, one file per scene\n");
+	printf("  -log <path>      write a replay log of each scene to path.<scene>\n");
+	printf("  -replay <file>   run a replay log headless and report the first diverging step\n");
+	printf("  -profile         print the time of each phase, needs a build with -DVERLET_PROFILE\n");
+	printf("  -sweep           run the sweep scenes from 1k particles up to -max in each solver mode\n");
+	printf("  -max <n>         largest sweep scene in particles (default %ld)\n", max_particles);
+	printf("  -test            run the self tests and exit\n");
+}
+
+int count_constraints(VerletJS* sim) {
+	int c, n = 0;
+	for (c=0; c<sim->composites.size(); c++)
+		n += sim->composites[c]->constraintCount();
+	return n;
+}
+
+// phases of the last steps of a scene, indented under its row
+void print_profile() {
+#ifdef VERLET_PROFILE
+	Profiler& profiler = Profiler::shared();
+	int p;
+	for (p=0; p<PROFILE_PHASES; p++)
+		printf("  %-16s avg %9.4f ms  p50 %9.4f ms  p95 %9.4f ms\n", profilePhaseName((ProfilePhase)p),
+			   profiler.average((ProfilePhase)p),
+			   profiler.percentile((ProfilePhase)p, 0.5),
+			   profiler.percentile((ProfilePhase)p, 0.95));
+	profiler.reset();
+#else
+	printf("  built without VERLET_PROFILE\n");
+#endif
+}
+
+void configure(VerletJS* sim) {
+	sim->solver = solver;
+	sim->pool = pool;
+	sim->parallelComposites = tasks;
+	sim->adaptive = tolerance > 0;
+	sim->tolerance = tolerance;
+	sim->minIterations = min_iterations;
+	sim->sleep = sleep_enabled;
+}
+
+void bench(int index) {
+	demo::active_demo = index;
+	demo::switch_demo(0);
+	
+	VerletJS* sim = demo::sim;
+	configure(sim);
+	
+	// the scene name is appended so that several scenes do not share a file
+	TrajectoryRecorder recorder;
+	if (record) {
+		char path[1024];
+		snprintf(path, sizeof(path), "%s.%s", record, demo::demo_names[index]);
+		if (recorder.open(path))
+			sim->recorder = &recorder;
+		else
+			printf("can not record to %s\n", path);
+	}
+	
+	ReplayLog log;
+	if (log_path) {
+		log.scene = index;
+		sim->replayLog = &log;
+	}
+	
+	double relaxations = 0, used = 0;
+	
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	
+	// first step after which a composite slept, -1 for none
+	int asleep = -1;
+	
+	int i;
+	for (i=0; i<steps; i++) {
+		sim->update(dt, iterations);
+		relaxations += sim->relaxations();
+		used += sim->iterations;
+		if (asleep < 0 && sim->sleep && sim->sleepingComposites() > 0)
+			asleep = i;
+		Profiler::shared().frame();
+	}
+	
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	int particles = sim->store.size();
+	
+	sim->recorder = NULL;
+	recorder.close();
+	
+	if (log_path) {
+		char path[1024];
+		snprintf(path, sizeof(path), "%s.%s", log_path, demo::demo_names[index]);
+		sim->replayLog = NULL;
+		if (!log.save(path))
+			printf("can not write %s\n", path);
+	}
+	
+	printf("%-8s %10d %12d %14.0f %16.0f %16.0f %11.2f\n",
+		   demo::demo_names[index],
+		   particles,
+		   count_constraints(sim),
+		   seconds*1.0e9/steps,
+		   particles*(double)steps/seconds,
+		   relaxations/seconds,
+		   used/steps);
+	
+	// the saving of -sleep depends on how soon the scene rests
+	if (sim->sleep && asleep < 0)
+		printf("%-8s no composite fell asleep\n", "");
+	else if (sim->sleep)
+		printf("%-8s %d of %d composites asleep at the end, the first after step %d\n", "",
+			   sim->sleepingComposites(), (int)sim->composites.size(), asleep);
+	
+	if (profile)
+		print_profile();
+}
+
+void bench_batch(int index) {
+	WorldBatch batch(pool);
+	batch.create(worlds, demo::sim_w, demo::sim_h, [index](VerletJS* sim, int i) {
+		configure(sim);
+		demo::demos[index](sim);
+	});
+	
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	batch.step(steps, dt, iterations);
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	
+	double particles = 0, constraints = 0, relaxations = 0;
+	int i;
+	for (i=0; i<batch.size(); i++) {
+		particles += batch.results[i].particles;
+		constraints += batch.results[i].constraints;
+		relaxations += batch.results[i].relaxations;
+	}
+	
+	// ns/step is per batch step of all the worlds, iterations are averaged over constraints
+	printf("%-8s %10.0f %12.0f %14.0f %16.0f %16.0f %11.2f\n",
+		   demo::demo_names[index],
+		   particles,
+		   constraints,
+		   seconds*1.0e9/steps,
+		   particles*steps/seconds,
+		   relaxations/seconds,
+		   constraints > 0 ? relaxations/(constraints*steps) : 0);
+}
+
+//////////////////////
+// size sweep
+//
+// every sweep scene is built at 1k, 10k, ... particles and stepped in each solver
+// mode, so that the time per particle shows where a scene falls out of the caches
+
+struct SweepMode {
+	const char* name;
+	VerletJS::Solver solver;
+	bool tasks;
+};
+
+SweepMode sweep_modes[] = {
+	{"serial", VerletJS::SOLVER_SERIAL, false},
+	{"colored", VerletJS::SOLVER_COLORED, false},
+	{"tasks", VerletJS::SOLVER_SERIAL, true}
+};
+
+// a size runs -n steps, or fewer once it has run this long
+const double sweep_seconds = 1;
+
+// resident memory of the process in MB, 0 where it can not be read
+double resident_mb() {
+#ifdef __APPLE__
+	mach_task_basic_info info;
+	mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+	if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &count) != KERN_SUCCESS)
+		return 0;
+	return info.resident_size/1048576.0;
+#else
+	FILE* f = fopen("/proc/self/status", "r");
+	if (!f)
+		return 0;
+	char line[256];
+	long kb = 0;
+	while (fgets(line, sizeof(line), f))
+		if (sscanf(line, "VmRSS: %ld kB", &kb) == 1)
+			break;
+	fclose(f);
+	return kb/1024.0;
+#endif
+}
+
+// memory is what the scene adds to the process after building and a first step,
+// which also builds the batches and colors of the solver
+void bench_sweep(int index) {
+	long n;
+	int m;
+	for (n=1000; n<=max_particles; n*=10) {
+		for (m=0; m<sizeof(sweep_modes)/sizeof(sweep_modes[0]); m++) {
+			SweepMode& mode = sweep_modes[m];
+			
+			// hands the freed memory of the last scene back, so it is not counted twice
+#ifdef __GLIBC__
+			malloc_trim(0);
+#endif
+			double before = resident_mb();
+			
+			VerletJS* sim = scenes::builders[index](n);
+			configure(sim);
+			sim->solver = mode.solver;
+			sim->parallelComposites = mode.tasks;
+			sim->update(dt, iterations);
+			
+			double memory = resident_mb() - before;
+			double relaxations = 0;
+			
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+			double seconds = 0;
+			int i;
+			for (i=0; i<steps && seconds < sweep_seconds; i++) {
+				sim->update(dt, iterations);
+				relaxations += sim->relaxations();
+				seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+			}
+			
+			int particles = sim->store.size();
+			printf("%-10s %-8s %10d %12d %14.0f %12.2f %10.1f %16.0f\n",
+				   scenes::names[index],
+				   mode.name,
+				   particles,
+				   count_constraints(sim),
+				   seconds*1.0e9/i,
+				   seconds*1.0e9/((double)i*particles),
+				   memory,
+				   relaxations/seconds);
+			fflush(stdout);
+			
+			delete sim;
+		}
+	}
+}
+
+int replay(const char* path) {
+	ReplayLog log;
+	if (!log.load(path) || log.scene < 0 || log.scene >= demo::num_demos) {
+		printf("%s is not a replay log\n", path);
+		return 1;
+	}
+	
+	VerletJS* sim = new VerletJS(log.width, log.height, log.seed);
+	sim->pool = pool;
+	sim->parallelComposites = tasks;
+	demo::demos[log.scene](sim);
+	
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	int diverged = sim->replay(log);
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	delete sim;
+	
+	printf("%s: %s, %d steps, %d events, %.0f steps/s\n", path, demo::demo_names[log.scene],
+		   (int)log.steps.size(), (int)log.events.size(), (diverged < 0 ? log.steps.size() : diverged+1)/seconds);
+	
+	if (diverged >= 0) {
+		printf("state diverges at step %d\n", diverged);
+		return 2;
+	}
+	
+	printf("state matches at every step\n");
+	return 0;
+}
+
+int main(int argc, char * argv[]) {
+	vector<const char*> names;
+	vector<int> selected;
+	const char* replay_path = NULL;
+	
+	int i, d;
+	for (i=1; i<argc; i++) {
+		if (!strcmp(argv[i], "-n") && i+1 < argc) {
+			steps = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-dt") && i+1 < argc) {
+			dt = atof(argv[++i]);
+		} else if (!strcmp(argv[i], "-i") && i+1 < argc) {
+			iterations = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-adaptive") && i+1 < argc) {
+			tolerance = atof(argv[++i]);
+		} else if (!strcmp(argv[i], "-min") && i+1 < argc) {
+			min_iterations = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-sleep")) {
+			sleep_enabled = true;
+		} else if (!strcmp(argv[i], "-solver") && i+1 < argc) {
+			i++;
+			if (!strcmp(argv[i], "serial"))
+				solver = VerletJS::SOLVER_SERIAL;
+			else if (!strcmp(argv[i], "colored"))
+				solver = VerletJS::SOLVER_COLORED;
+			else {
+				usage();
+				return 1;
+			}
+		} else if (!strcmp(argv[i], "-threads") && i+1 < argc) {
+			pool = new ThreadPool(atoi(argv[++i]));
+		} else if (!strcmp(argv[i], "-tasks")) {
+			tasks = true;
+		} else if (!strcmp(argv[i], "-worlds") && i+1 < argc) {
+			worlds = max(1, atoi(argv[++i]));
+		} else if (!strcmp(argv[i], "-record") && i+1 < argc) {
+			record = argv[++i];
+		} else if (!strcmp(argv[i], "-log") && i+1 < argc) {
+			log_path = argv[++i];
+		} else if (!strcmp(argv[i], "-replay") && i+1 < argc) {
+			replay_path = argv[++i];
+		} else if (!strcmp(argv[i], "-sweep")) {
+			sweep = true;
+		} else if (!strcmp(argv[i], "-max") && i+1 < argc) {
+			max_particles = atol(argv[++i]);
+		} else if (!strcmp(argv[i], "-profile")) {
+			profile = true;
+		} else if (!strcmp(argv[i], "-test")) {
+			test_Vec2();
+			test_fastTrig();
+			test_relaxAngle();
+			test_SlotMap();
+			test_DistanceBatch();
+			test_Collisions();
+			test_RenderList();
+			test_Handoff();
+			test_Snapshot();
+			test_Trajectory();
+			test_GridCloth();
+			test_Tasks();
+			test_Adaptive();
+			test_Sleep();
+			return 0;
+		} else {
+			names.push_back(argv[i]);
+		}
+	}
+	
+	if (replay_path)
+		return replay(replay_path);
+	
+	// scene names are those of the demos, or of the sweep scenes with -sweep
+	const char** scene_names = sweep ? scenes::names : demo::demo_names;
+	int scene_count = sweep ? scenes::count : demo::num_demos;
+	
+	for (i=0; i<names.size(); i++) {
+		for (d=0; d<scene_count; d++)
+			if (!strcmp(names[i], scene_names[d]))
+				break;
+		
+		if (d == scene_count) {
+			usage();
+			return 1;
+		}
+		selected.push_back(d);
+	}
+	
+	if (selected.empty())
+		for (d=0; d<scene_count; d++)
+			selected.push_back(d);
+	
+	if (sweep) {
+		printf("%-10s %-8s %10s %12s %14s %12s %10s %16s\n", "scene", "solver", "particles", "constraints", "ns/step", "ns/particle", "MB", "relaxations/s");
+		
+		for (i=0; i<selected.size(); i++)
+			bench_sweep(selected[i]);
+		
+		delete pool;
+		return 0;
+	}
+	
+	printf("%-8s %10s %12s %14s %16s %16s %11s\n", "scene", "particles", "constraints", "ns/step", "particles/s", "relaxations/s", "iterations");
+	
+	for (i=0; i<selected.size(); i++) {
+		if (worlds > 1)
+			bench_batch(selected[i]);
+		else
+			bench(selected[i]);
+	}
+	
+	delete demo::sim;
+	delete pool;
+	
+	return 0;
+}
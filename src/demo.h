@@ -15,13 +15,14 @@ namespace demo {
 	
 	void switch_demo(int count);
 	
-	void demo_shapes();
-	void demo_trees();
-	void demo_cloth();
-	void demo_spider();
+	void demo_shapes(VerletJS* sim);
+	void demo_trees(VerletJS* sim);
+	void demo_cloth(VerletJS* sim);
+	void demo_spider(VerletJS* sim);
 	
-	void (*demos[])() = {demo_shapes, demo_trees, demo_cloth, demo_spider};
-	int num_demos = sizeof(demos)/sizeof(void*);
+	void (*demos[])(VerletJS*) = {demo_shapes, demo_trees, demo_cloth, demo_spider};
+	const char* demo_names[] = {"shapes", "trees", "cloth", "spider"};
+	int num_demos = sizeof(demos)/sizeof(demos[0]);
 	int active_demo = 3;
 	
 	//////////////////////////////
@@ -40,6 +41,7 @@ namespace demo {
 			delete sim;
 		
 		sim = new VerletJS(sim_w, sim_h);
+		sim->fixedStep = 1/60.0f;
 		
 		active_demo += max(-1,min(+1, count));
 		
@@ -48,13 +50,13 @@ namespace demo {
 		else if (active_demo < 0)
 			active_demo = num_demos - abs(active_demo) % num_demos;
 		
-		demos[active_demo]();
+		demos[active_demo](sim);
 	}
 	
 	///////////////////
 	// available demos
 	
-	void demo_shapes() {
+	void demo_shapes(VerletJS* sim) {
 		// settings
 		sim->friction = 1;
 		
@@ -69,37 +71,38 @@ namespace demo {
 		Tire* tire3 = new Tire(sim, Vec2(600,50), 70, 3, 1, 1);
 	}
 	
-	void demo_trees() {
+	void demo_trees(VerletJS* sim) {
 		// settings
 		sim->gravity = Vec2(0,0);
 		sim->friction = 0.98;
 		
 		// entities
-		Tree* tree1 = new Tree(sim, Vec2(sim_w/4,sim_h-120), 5, 70, 0.95, (M_PI/2)/3);
+		Tree* tree1 = new Tree(sim, Vec2(sim->width/4,sim->height-120), 5, 70, 0.95, (M_PI/2)/3);
 		tree1->debugDraw = true;
 		
-		Tree* tree2 = new Tree(sim, Vec2(sim_w - sim_w/4,sim_h-120), 5, 70, 0.95, (M_PI/2)/3);
+		Tree* tree2 = new Tree(sim, Vec2(sim->width - sim->width/4,sim->height-120), 5, 70, 0.95, (M_PI/2)/3);
 	}
 	
-	void demo_cloth() {
+	void demo_cloth(VerletJS* sim) {
 		// settings
 		sim->friction = 1;
-		sim->highlightColor[0] = 255;
-		sim->highlightColor[1] = 255;
-		sim->highlightColor[2] = 255;
+		sim->highlightColor = Color(255, 255, 255);
 		
 		// entities
-		float min = fmin(sim_w,sim_h)*0.5;
+		float min = fmin(sim->width,sim->height)*0.5;
 		int segments = 20;
 		
-		Cloth* cloth = new Cloth(sim, Vec2(sim_w/2,sim_h/3), min, min, segments, 6, 0.9);
+		Cloth* cloth = new Cloth(sim, Vec2(sim->width/2,sim->height/3), min, min, segments, 6, 0.9);
+		
+		// pulled hard enough, it tears
+		cloth->tear(3);
 	}
 	
-	void demo_spider() {
+	void demo_spider(VerletJS* sim) {
 		// settings
 		
 		// entities
-		Spiderweb* spiderweb = new Spiderweb(sim, Vec2(sim_w/2,sim_h/2), fmin(sim_w, sim_h)/2, 20, 7);
-		Spider* spider = new Spider(sim, spiderweb, Vec2(sim_w/2,-300));
+		Spiderweb* spiderweb = new Spiderweb(sim, Vec2(sim->width/2,sim->height/2), fmin(sim->width, sim->height)/2, 20, 7);
+		Spider* spider = new Spider(sim, spiderweb, Vec2(sim->width/2,-300));
 	}
 }
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <GLUT/GLUT.h>
+
+#include "renderlist.h"
+
+// OpenGL backend for the demo: draws each list of a recorded RenderList with one
+// call from a vertex array
+struct GLRenderer {
+	void submit(RenderVertices& v) {
+		if (v.empty())
+			return;
+		
+		glVertexPointer(2, GL_FLOAT, sizeof(RenderVertex), &v[0].x);
+		glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(RenderVertex), &v[0].color);
+		glDrawArrays(GL_TRIANGLES, 0, (GLsizei)v.size());
+	}
+	
+	void draw(RenderList& list) {
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+		glEnableClientState(GL_VERTEX_ARRAY);
+		glEnableClientState(GL_COLOR_ARRAY);
+		
+		submit(list.quads);
+		submit(list.lines);
+		submit(list.circles);
+		submit(list.points);
+		
+		glDisableClientState(GL_COLOR_ARRAY);
+		glDisableClientState(GL_VERTEX_ARRAY);
+		glDisable(GL_BLEND);
+	}
+};
@@ -4,6 +4,8 @@
 
 #include "util.h"
 #include "demo.h"
+#include "glrenderer.h"
+#include "handoff.h"
 
 //////////////////////
 // simulation metrics
@@ -17,6 +19,203 @@ float sim_scale_h;
 float sim_x_origin;
 float sim_y_origin;
 
+GLRenderer renderer;
+
+// with -log <path> the session of every scene is written to path.0, path.1, ...
+// and can be run again with verletc-bench -replay
+const char* log_path = NULL;
+int log_count = 0;
+ReplayLog session;
+
+// per-phase timings, available when built with VERLET_PROFILE
+bool show_profile = false;
+
+// composites at rest sleep, see VerletJS::sleep
+bool sleep_enabled = false;
+
+
+//////////////////////
+// simulation thread
+//
+// the simulation steps on its own thread and publishes a frame after each step,
+// and in between as often as the display shows one, interpolated between the
+// last two steps; the GLUT thread shows the newest frame and sends input back:
+// clicks and key presses through a queue, the pointer as its latest position
+// since only that one matters. Neither waits for the other, except that send()
+// waits for room while the queue is full, until the next pass of the simulation
+// thread
+
+// what the GLUT thread needs of a frame, written by the simulation thread only
+struct Frame {
+	RenderList list;
+	int demo = -1;
+	bool sleep = false;
+	float steps = 0;
+	
+	// ms per frame of each phase, with VERLET_PROFILE
+	float average[PROFILE_PHASES];
+	float p95[PROFILE_PHASES];
+};
+
+struct InputEvent {
+	enum Type {
+		CLICK,
+		SWITCH,
+		SLEEP
+	};
+	
+	Type type;
+	int button;
+	bool down;
+	int x;
+	int y;
+};
+
+TripleBuffer<Frame> frames;
+SpscQueue<InputEvent, 256> input;
+// x in the high and y in the low half, valid while moved is set
+atomic<uint64_t> pointer(0);
+atomic<bool> moved(false);
+// seconds between two frames of the display, measured by the GLUT thread
+atomic<float> display_interval(1.0f/60);
+atomic<bool> running(true);
+thread sim_thread;
+
+
+//////////////////////
+// session logging
+
+void save_log() {
+	if (!log_path || session.steps.empty())
+		return;
+	
+	char path[1024];
+	snprintf(path, sizeof(path), "%s.%d", log_path, log_count++);
+	if (!session.save(path))
+		printf("can not write %s\n", path);
+}
+
+void start_log() {
+	if (!log_path)
+		return;
+	
+	session.clear();
+	session.scene = demo::active_demo;
+	demo::sim->replayLog = &session;
+}
+
+void switch_demo(int count) {
+	save_log();
+	demo::switch_demo(count);
+	demo::sim->sleep = sleep_enabled;
+	start_log();
+}
+
+
+void apply(InputEvent& e) {
+	switch (e.type) {
+		case InputEvent::CLICK:
+			demo::sim->onMouseClick(e.button, e.down, e.x, e.y);
+			break;
+			
+		case InputEvent::SWITCH:
+			switch_demo(e.button);
+			break;
+			
+		case InputEvent::SLEEP:
+			// restarts so that a session log holds a single setting
+			sleep_enabled = !sleep_enabled;
+			switch_demo(0);
+			break;
+	}
+}
+
+void publish(int steps, double seconds) {
+	Frame& frame = frames.write();
+	frame.list.clear();
+	demo::sim->draw(frame.list);
+	frame.demo = demo::active_demo;
+	frame.sleep = sleep_enabled;
+	frame.steps = seconds > 0 ? steps/seconds : 0;
+	
+#ifdef VERLET_PROFILE
+	Profiler& profiler = Profiler::shared();
+	int p;
+	for (p=0; p<PROFILE_PHASES; p++) {
+		frame.average[p] = profiler.average((ProfilePhase)p);
+		frame.p95[p] = profiler.percentile((ProfilePhase)p, 0.95);
+	}
+#endif
+	
+	frames.publish();
+}
+
+void sim_loop() {
+	demo::init(sim_w, sim_h);
+	demo::sim->sleep = sleep_enabled;
+	start_log();
+	
+	// steps per second are counted over half a second
+	double last = seconds(), rate_start = last, last_frame = last;
+	int steps = 0, rate_steps = 0;
+	
+	while (running) {
+		InputEvent e;
+		while (input.pop(e))
+			apply(e);
+		
+		if (moved.exchange(false)) {
+			uint64_t p = pointer.load();
+			demo::sim->onMouseMove((int32_t)(p >> 32), (int32_t)p);
+		}
+		
+		double now = seconds();
+		int n = demo::sim->advance(now - last);
+		last = now;
+		
+		steps += n;
+		if (now - rate_start >= 0.5) {
+			rate_steps = steps;
+			steps = 0;
+			rate_start = now;
+		}
+		
+		// a frame per step, and between steps one whenever the display is due
+		// for another; the display shows the newest
+		if (n > 0 || now - last_frame >= display_interval) {
+			publish(rate_steps, 0.5);
+			last_frame = now;
+			if (n > 0)
+				Profiler::shared().frame();
+		} else {
+			this_thread::sleep_for(chrono::milliseconds(1));
+		}
+	}
+	
+	save_log();
+}
+
+// waits for room rather than lose a click or key press; the simulation thread
+// empties the queue on every pass
+void send(InputEvent::Type type, int button = 0, bool down = false, int x = 0, int y = 0) {
+	InputEvent e = {type, button, down, x, y};
+	while (!input.push(e))
+		this_thread::yield();
+}
+
+// replaces the position the simulation thread has not applied yet
+void send_move(int x, int y) {
+	pointer = (uint64_t)(uint32_t)x << 32 | (uint32_t)y;
+	moved = true;
+}
+
+void quit() {
+	running = false;
+	if (sim_thread.joinable())
+		sim_thread.join();
+	exit(0);
+}
+
 
 //////////////////////
 // main program
@@ -32,18 +231,21 @@ void display() {
 	glScalef(sim_min_scale * sim_scale_w, -sim_min_scale * sim_scale_h, 1);
 	
 	float dt = time_interval();
+	display_interval = dt;
 	
-	if (demo::active_demo != 2)
+	frames.acquire();
+	Frame& frame = frames.read();
+	
+	if (frame.demo != 2)
 		glClearColor(1, 1, 1, 1);
 	else
 		glClearColor(0, 0, 0, 1);
 	
 	glClear(GL_COLOR_BUFFER_BIT);
 	
-	demo::sim->update(dt);
-	demo::sim->draw();
+	renderer.draw(frame.list);
 	
-	if (demo::active_demo != 2)
+	if (frame.demo != 2)
 		glColor3f(0, 0, 0);
 	else
 		glColor3f(1, 1, 1);
@@ -67,6 +269,10 @@ void display() {
 		glRasterPos2d(lw,++l*lh);
 		draw_str(" [ H ] - show / hide help.", GLUT_BITMAP_HELVETICA_12);
 		glRasterPos2d(lw,++l*lh);
+		draw_str(" [ P ] - show / hide profiler.", GLUT_BITMAP_HELVETICA_12);
+		glRasterPos2d(lw,++l*lh);
+		draw_str(" [ S ] - restart with sleeping composites on / off (%s).", GLUT_BITMAP_HELVETICA_12, frame.sleep ? "on" : "off");
+		glRasterPos2d(lw,++l*lh);
 		draw_str(" [ ESC ] - quit.", GLUT_BITMAP_HELVETICA_12);
 		++l;
 		glRasterPos2d(lw,++l*lh);
@@ -74,8 +280,26 @@ void display() {
 		glRasterPos2d(lw,++l*lh);
 	}
 	
+	if (show_profile) {
+		// right half of the window, ms per frame over the last frames
+		float px = sim_w/2 * sim_scale_w;
+		int l=0;
+#ifdef VERLET_PROFILE
+		glRasterPos2d(px,++l*lh);
+		draw_str("phase                avg ms    p95 ms", GLUT_BITMAP_HELVETICA_12);
+		int p;
+		for (p=0; p<PROFILE_PHASES; p++) {
+			glRasterPos2d(px,++l*lh);
+			draw_str("%-20s %7.3f %8.3f", GLUT_BITMAP_HELVETICA_12, profilePhaseName((ProfilePhase)p), frame.average[p], frame.p95[p]);
+		}
+#else
+		glRasterPos2d(px,++l*lh);
+		draw_str("Build with VERLET_PROFILE defined to profile.", GLUT_BITMAP_HELVETICA_12);
+#endif
+	}
+	
 	glRasterPos2d(lw,sim_h-0.3f*lh);
-	draw_str("Framerate %.2f", GLUT_BITMAP_HELVETICA_12, 1.0f/dt);
+	draw_str("Framerate %.2f, steps/s %.0f", GLUT_BITMAP_HELVETICA_12, 1.0f/dt, frame.steps);
 	
 	glutSwapBuffers();
 }
@@ -98,24 +322,24 @@ void mouse ( int button, int state, int x, int y ) {
 	x = (x * sim_scale_w - 0.5 * sim_w)/(sim_min_scale * sim_scale_w) + 0.5 * sim_w;
 	y = (y * sim_scale_h - 0.5 * sim_h)/(sim_min_scale * sim_scale_h) + 0.5 * sim_h;
 	
-	demo::sim->onMouseClick(button, state, x, y);
+	send(InputEvent::CLICK, button, state == GLUT_DOWN, x, y);
 }
 
 void motion ( int x, int y ) {
 	x = (x * sim_scale_w - 0.5 * sim_w)/(sim_min_scale * sim_scale_w) + 0.5 * sim_w;
 	y = (y * sim_scale_h - 0.5 * sim_h)/(sim_min_scale * sim_scale_h) + 0.5 * sim_h;
 	
-	demo::sim->onMouseMove(x, y);
+	send_move(x, y);
 }
 
 void specialkeys(int key, int x, int y) {
 	switch (key) {
 		case GLUT_KEY_LEFT:
-			demo::switch_demo(-1);
+			send(InputEvent::SWITCH, -1);
 			break;
 			
 		case GLUT_KEY_RIGHT:
-			demo::switch_demo(1);
+			send(InputEvent::SWITCH, 1);
 			break;
 			
 		default :
@@ -127,17 +351,25 @@ void keyboard( unsigned char key, int x, int y ) {
 	key = toupper(key);
 	switch (key) {
 		case 27:
-			exit(0);
+			quit();
 			break;
 			
 		case 'R':
-			demo::switch_demo(0);
+			send(InputEvent::SWITCH, 0);
 			break;
 			
 		case 'H':
 			demo::show_help = !demo::show_help;
 			break;
 			
+		case 'P':
+			show_profile = !show_profile;
+			break;
+			
+		case 'S':
+			send(InputEvent::SLEEP);
+			break;
+			
 		default :
 			break;
 	}
@@ -146,6 +378,11 @@ void keyboard( unsigned char key, int x, int y ) {
 int main(int argc, char * argv[]) {
 	
 	glutInit(&argc, argv);
+	
+	int i;
+	for (i=1; i<argc; i++)
+		if (!strcmp(argv[i], "-log") && i+1 < argc)
+			log_path = argv[++i];
 	glutInitWindowSize ( sim_w, sim_h );
 	glutCreateWindow("VerletC Demo");
 	
@@ -164,7 +401,7 @@ int main(int argc, char * argv[]) {
 	glLoadIdentity();
 	glOrtho(0, sim_w, 0, sim_h, -1, 1);
 	
-	demo::init(sim_w, sim_h);
+	sim_thread = thread(sim_loop);
 	
 	glutMainLoop();
 	
@@ -0,0 +1,393 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <string>
+#include <map>
+
+#include "verlet.h"
+#include "objects.h"
+#include "cloth.h"
+#include "gridcloth.h"
+#include "renderlist.h"
+
+//////////////////////
+// measurement
+//
+// every benchmark is timed in several samples; a sample repeats the operation
+// until it has run for at least min_sample_ms, so clock resolution does not
+// matter. The median is the result, min/max and the median absolute deviation
+// tell how noisy it is.
+
+int samples = 7;
+double min_sample_ms = 20;
+int max_particles = 1000000;
+const char* filter = NULL;
+
+// keeps results alive so the compiler does not remove the measured work
+volatile float sink;
+
+struct Result {
+	string name;
+	long n;
+	double median;
+	double min;
+	double max;
+	double mad;
+};
+
+vector<Result> results;
+
+double now() {
+	return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+double median(vector<double> v) {
+	sort(v.begin(), v.end());
+	int n = (int)v.size();
+	return n%2 ? v[n/2] : 0.5*(v[n/2-1] + v[n/2]);
+}
+
+// fn(reps) runs the operation reps times, ops is the number of operations per repetition
+template<typename F>
+void measure(const char* name, long n, long ops, F fn) {
+	if (filter && !strstr(name, filter))
+		return;
+	
+	// find how many repetitions fill a sample
+	long reps = 1;
+	while (true) {
+		double start = now();
+		fn(reps);
+		double ms = (now()-start)*1e3;
+		if (ms >= min_sample_ms || reps >= (1L << 30))
+			break;
+		reps = ms <= 0 ? reps*16 : max(reps*2, (long)(reps*min_sample_ms/ms*1.2));
+	}
+	
+	vector<double> ns;
+	int s;
+	for (s=0; s<samples; s++) {
+		double start = now();
+		fn(reps);
+		ns.push_back((now()-start)*1e9/(reps*(double)ops));
+	}
+	
+	Result r;
+	r.name = name;
+	r.n = n;
+	r.median = median(ns);
+	r.min = *min_element(ns.begin(), ns.end());
+	r.max = *max_element(ns.begin(), ns.end());
+	vector<double> deviation;
+	for (s=0; s<samples; s++)
+		deviation.push_back(fabs(ns[s]-r.median));
+	r.mad = median(deviation);
+	results.push_back(r);
+	
+	fprintf(stderr, "%-24s %9ld %12.3f ns/op  (min %.3f, max %.3f, mad %.3f)\n", name, n, r.median, r.min, r.max, r.mad);
+}
+
+
+//////////////////////
+// benchmarks
+
+vector<Vec2> random_points(int n) {
+	Random random(7);
+	vector<Vec2> v(n);
+	int i;
+	for (i=0; i<n; i++)
+		v[i] = Vec2(random.uniform()*800, random.uniform()*500);
+	return v;
+}
+
+void bench_vec2() {
+	const int n = 1024;
+	vector<Vec2> p = random_points(n);
+	
+	measure("vec2_length", n, n, [&](long reps) {
+		float s = 0;
+		long r;
+		int i;
+		for (r=0; r<reps; r++)
+			for (i=0; i<n; i++)
+				s += p[i].length();
+		sink = s;
+	});
+	
+	measure("vec2_angle2", n, n, [&](long reps) {
+		float s = 0;
+		long r;
+		int i;
+		for (r=0; r<reps; r++)
+			for (i=0; i<n; i++)
+				s += p[i].angle2(p[(i+1)%n], p[(i+2)%n]);
+		sink = s;
+	});
+	
+	measure("vec2_rotate", n, n, [&](long reps) {
+		Vec2 s(0, 0);
+		long r;
+		int i;
+		for (r=0; r<reps; r++)
+			for (i=0; i<n; i++)
+				s += p[i].rotate(p[(i+1)%n], 0.001f*i);
+		sink = s.x + s.y;
+	});
+}
+
+// a chain of n particles with a distance constraint between neighbors and an
+// angle constraint over every three
+struct Chain : public Composite {
+	Chain(VerletJS* sim, int n): Composite(&sim->store) {
+		vector<Vec2> p = random_points(n);
+		int i;
+		for (i=0; i<n; i++)
+			particles.push_back(make<Particle>(store, p[i]));
+		for (i=1; i<n; i++)
+			constraints.push_back(make<DistanceConstraint>(particles[i-1], particles[i], 0.5f));
+		for (i=2; i<n; i++)
+			constraints.push_back(make<AngleConstraint>(particles[i-2], particles[i-1], particles[i], 0.5f));
+		sim->composites.push_back(this);
+	}
+};
+
+void bench_constraints() {
+	const int n = 4096;
+	VerletJS sim(800, 500);
+	Chain* chain = new Chain(&sim, n);
+	
+	// the constraints stay in their own ranges of the list
+	int distances = n-1, angles = n-2;
+	Constraints& c = chain->constraints;
+	
+	measure("distance_relax", distances, distances, [&](long reps) {
+		long r;
+		int i;
+		for (r=0; r<reps; r++)
+			for (i=0; i<distances; i++)
+				c[i]->relax(0.0625f);
+	});
+	
+	measure("angle_relax", angles, angles, [&](long reps) {
+		long r;
+		int i;
+		for (r=0; r<reps; r++)
+			for (i=0; i<angles; i++)
+				c[distances+i]->relax(0.0625f);
+	});
+	
+	// the same constraints through the batches used by Composite::relax
+	chain->relax(0.0625f);
+	ConstraintBatches& b = chain->batches;
+	float* x = sim.store.x.data();
+	float* y = sim.store.y.data();
+	
+	measure("distance_batch", distances, distances, [&](long reps) {
+		long r;
+		for (r=0; r<reps; r++)
+			b.distances.relax(x, y, 0.0625f);
+	});
+	
+	measure("angle_batch", angles, angles, [&](long reps) {
+		long r;
+		for (r=0; r<reps; r++)
+			b.angles.relax(x, y, 0.0625f);
+	});
+	
+	// grouped by color as for the colored solver, eight at a time with AVX2
+	AngleBatch colored = b.angles;
+	colored.color();
+	
+	measure("angle_batch_colored", angles, angles, [&](long reps) {
+		long r;
+		for (r=0; r<reps; r++)
+			colored.relax(x, y, 0.0625f);
+	});
+}
+
+// full steps of a square cloth, as Cloth and GridCloth, and of a field of tires
+// with about n particles
+void bench_update() {
+	long n;
+	for (n=1000; n<=max_particles; n*=10) {
+		char name[64];
+		
+		{
+			VerletJS sim(2000, 2000);
+			int segments = (int)sqrt((double)n);
+			new Cloth(&sim, Vec2(1000, 1000), 1500, 1500, segments, 6, 0.9);
+			snprintf(name, sizeof(name), "update_cloth");
+			measure(name, sim.store.size(), sim.store.size(), [&](long reps) {
+				long r;
+				for (r=0; r<reps; r++)
+					sim.update(1.0f/60);
+			});
+		}
+		
+		{
+			VerletJS sim(2000, 2000);
+			int segments = (int)sqrt((double)n);
+			new GridCloth<>(&sim, Vec2(1000, 1000), 1500, 1500, segments, 6, 0.9);
+			snprintf(name, sizeof(name), "update_gridcloth");
+			measure(name, sim.store.size(), sim.store.size(), [&](long reps) {
+				long r;
+				for (r=0; r<reps; r++)
+					sim.update(1.0f/60);
+			});
+		}
+		
+		{
+			VerletJS sim(4000, 4000);
+			int tires = (int)(n/31), side = (int)ceil(sqrt((double)tires));
+			int i;
+			sim.store.reserve(tires*31);
+			for (i=0; i<tires; i++)
+				new Tire(&sim, Vec2(100 + (i%side)*3900.0f/side, 100 + (i/side)*3900.0f/side), 10, 30, 0.3, 0.9);
+			snprintf(name, sizeof(name), "update_tires");
+			measure(name, sim.store.size(), sim.store.size(), [&](long reps) {
+				long r;
+				for (r=0; r<reps; r++)
+					sim.update(1.0f/60);
+			});
+		}
+	}
+}
+
+
+// a frame of a cloth and of a field of tires recorded into a RenderList, per vertex
+void bench_render() {
+	VerletJS sim(2000, 2000);
+	new Cloth(&sim, Vec2(1000, 1000), 1500, 1500, 100, 6, 0.9);
+	int i;
+	for (i=0; i<100; i++)
+		new Tire(&sim, Vec2(100 + (i%10)*190.0f, 100 + (i/10)*190.0f), 10, 30, 0.3, 0.9);
+	
+	RenderList list;
+	sim.draw(list);
+	long vertices = list.size();
+	
+	measure("render_list", vertices, vertices, [&](long reps) {
+		long r;
+		for (r=0; r<reps; r++) {
+			list.clear();
+			sim.draw(list);
+		}
+	});
+}
+
+
+//////////////////////
+// output
+
+void write_json(FILE* f) {
+	fprintf(f, "{\n  \"samples\": %d,\n  \"unit\": \"ns/op\",\n  \"results\": [\n", samples);
+	int i;
+	for (i=0; i<results.size(); i++) {
+		Result& r = results[i];
+		fprintf(f, "    {\"name\": \"%s\", \"n\": %ld, \"median\": %.4f, \"min\": %.4f, \"max\": %.4f, \"mad\": %.4f}%s\n",
+				r.name.c_str(), r.n, r.median, r.min, r.max, r.mad, i+1 < results.size() ? "," : "");
+	}
+	fprintf(f, "  ]\n}\n");
+}
+
+// reads the results of a previous run, one result per line as written above
+bool read_json(const char* path, map<string, Result>& out) {
+	FILE* f = fopen(path, "r");
+	if (!f)
+		return false;
+	
+	char line[512];
+	while (fgets(line, sizeof(line), f)) {
+		char name[64];
+		Result r;
+		if (sscanf(line, " {\"name\": \"%63[^\"]\", \"n\": %ld, \"median\": %lf, \"min\": %lf, \"max\": %lf, \"mad\": %lf}",
+				   name, &r.n, &r.median, &r.min, &r.max, &r.mad) == 6) {
+			r.name = name;
+			out[r.name + "/" + to_string(r.n)] = r;
+		}
+	}
+	fclose(f);
+	return true;
+}
+
+// a change counts when the sample ranges of both runs do not overlap
+void compare(map<string, Result>& base) {
+	fprintf(stderr, "\n%-24s %9s %12s %12s %8s\n", "benchmark", "n", "base ns/op", "ns/op", "speedup");
+	int i;
+	for (i=0; i<results.size(); i++) {
+		Result& r = results[i];
+		map<string, Result>::iterator it = base.find(r.name + "/" + to_string(r.n));
+		if (it == base.end())
+			continue;
+		
+		Result& b = it->second;
+		const char* verdict = r.max < b.min ? "faster" : r.min > b.max ? "slower" : "noise";
+		fprintf(stderr, "%-24s %9ld %12.3f %12.3f %7.2fx %s\n", r.name.c_str(), r.n, b.median, r.median, b.median/r.median, verdict);
+	}
+}
+
+void usage() {
+	printf("usage: verletc-microbench [options]\n");
+	printf("\n");
+	printf("Times Vec2 operations, constraint kernels, full steps and render lists, prints JSON to stdout.\n");
+	printf("\n");
+	printf("options:\n");
+	printf("  -samples <n>     samples per benchmark (default %d)\n", samples);
+	printf("  -ms <ms>         minimum duration of a sample (default %.0f)\n", min_sample_ms);
+	printf("  -max <n>         largest scene in particles (default %d)\n", max_particles);
+	printf("  -filter <text>   only benchmarks whose name contains text\n");
+	printf("  -o <path>        write the JSON to path instead of stdout\n");
+	printf("  -compare <path>  compare with the JSON of a previous run\n");
+}
+
+int main(int argc, char * argv[]) {
+	const char* output = NULL;
+	const char* base = NULL;
+	
+	int i;
+	for (i=1; i<argc; i++) {
+		if (!strcmp(argv[i], "-samples") && i+1 < argc) {
+			samples = max(1, atoi(argv[++i]));
+		} else if (!strcmp(argv[i], "-ms") && i+1 < argc) {
+			min_sample_ms = atof(argv[++i]);
+		} else if (!strcmp(argv[i], "-max") && i+1 < argc) {
+			max_particles = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-filter") && i+1 < argc) {
+			filter = argv[++i];
+		} else if (!strcmp(argv[i], "-o") && i+1 < argc) {
+			output = argv[++i];
+		} else if (!strcmp(argv[i], "-compare") && i+1 < argc) {
+			base = argv[++i];
+		} else {
+			usage();
+			return 1;
+		}
+	}
+	
+	map<string, Result> baseline;
+	if (base && !read_json(base, baseline)) {
+		printf("can not read %s\n", base);
+		return 1;
+	}
+	
+	bench_vec2();
+	bench_constraints();
+	bench_update();
+	bench_render();
+	
+	FILE* f = output ? fopen(output, "w") : stdout;
+	if (!f) {
+		printf("can not write %s\n", output);
+		return 1;
+	}
+	write_json(f);
+	if (output)
+		fclose(f);
+	
+	if (base)
+		compare(baseline);
+	
+	return 0;
+}
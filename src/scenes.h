@@ -0,0 +1,288 @@
+#pragma once
+
+#include "verlet.h"
+#include "objects.h"
+#include "tree.h"
+#include "cloth.h"
+#include "gridcloth.h"
+#include "spiderweb.h"
+
+// Scalable scenes -- the demo objects enlarged or repeated until a scene holds
+// about the given number of particles, from a thousand to many millions. Each
+// scene makes a world sized to it, so spacing and density stay those of the
+// demo at every size.
+namespace scenes {
+	
+	// a side of about sqrt(n) cells of the given size, never smaller than the demo
+	int side(long particles, float cell) {
+		return max(800, (int)(sqrt((double)particles)*cell));
+	}
+	
+	// one square cloth pinned along its top, spaced as in the cloth demo
+	VerletJS* cloth(long particles) {
+		int segments = max(2, (int)sqrt((double)particles));
+		float size = segments*12.5f;
+		VerletJS* sim = new VerletJS(side(particles, 16), side(particles, 16));
+		sim->friction = 1;
+		new Cloth(sim, Vec2(sim->width/2, sim->height/2), size, size, segments, 6, 0.9);
+		return sim;
+	}
+	
+	VerletJS* gridcloth(long particles) {
+		int segments = max(2, (int)sqrt((double)particles));
+		float size = segments*12.5f;
+		VerletJS* sim = new VerletJS(side(particles, 16), side(particles, 16));
+		sim->friction = 1;
+		new GridCloth<>(sim, Vec2(sim->width/2, sim->height/2), size, size, segments, 6, 0.9);
+		return sim;
+	}
+	
+	// a forest of the demo's trees, 257 particles each, without gravity as in the demo
+	VerletJS* trees(long particles) {
+		const int depth = 7, size = 257;
+		int count = max(1, (int)(particles/size)), columns = (int)ceil(sqrt((double)count));
+		VerletJS* sim = new VerletJS(columns*300, columns*300);
+		sim->gravity = Vec2(0,0);
+		sim->friction = 0.98;
+		
+		int i;
+		for (i=0; i<count; i++)
+			new Tree(sim, Vec2(150 + (i%columns)*300, 290 + (i/columns)*300), depth, 70, 0.95, (M_PI/2)/3);
+		return sim;
+	}
+	
+	// one web of the demo's proportions, 20 segments to 7 rings, and its spider
+	VerletJS* web(long particles) {
+		int segments = max(8, (int)sqrt(particles*20/7.0)), depth = max(2, (int)(particles/segments));
+		float radius = 21*sqrt((double)segments*depth);
+		VerletJS* sim = new VerletJS((int)(2.2f*radius), (int)(2.2f*radius));
+		
+		Spiderweb* spiderweb = new Spiderweb(sim, Vec2(sim->width/2, sim->height/2), radius, segments, depth);
+		new Spider(sim, spiderweb, Vec2(sim->width/2, -300));
+		return sim;
+	}
+	
+	// a field of the demo's large tire, 31 particles each
+	VerletJS* tires(long particles) {
+		int count = max(1, (int)(particles/31)), columns = (int)ceil(sqrt((double)count));
+		VerletJS* sim = new VerletJS(columns*150, columns*150);
+		sim->friction = 1;
+		sim->store.reserve(count*31);
+		
+		int i;
+		for (i=0; i<count; i++)
+			new Tire(sim, Vec2(75 + (i%columns)*150, 75 + (i/columns)*150), 50, 30, 0.3, 0.9);
+		return sim;
+	}
+	
+	// rows of ropes of 64 particles pinned at both ends
+	VerletJS* ropes(long particles) {
+		const int length = 64;
+		int count = max(1, (int)(particles/length)), columns = (int)ceil(sqrt(count/8.0));
+		int rows = (count + columns-1)/columns;
+		VerletJS* sim = new VerletJS(columns*700, rows*100 + 200);
+		sim->friction = 1;
+		sim->store.reserve(count*length);
+		
+		Vec2 vertices[length];
+		int i, j;
+		for (i=0; i<count; i++) {
+			Vec2 origin = Vec2(30 + (i%columns)*700, 50 + (i/columns)*100);
+			for (j=0; j<length; j++)
+				vertices[j] = origin + Vec2(j*10, 0);
+			
+			Composite* rope = new LineSegments(sim, vertices, 0.5);
+			rope->pin(0);
+			rope->pin(length-1);
+		}
+		return sim;
+	}
+	
+	VerletJS* (*builders[])(long) = {cloth, gridcloth, trees, web, tires, ropes};
+	const char* names[] = {"cloth", "gridcloth", "trees", "web", "tires", "ropes"};
+	int count = sizeof(builders)/sizeof(builders[0]);
+}
+
+// a cloth, a web with its spider and a tree in one world, for the tests below
+VerletJS* mixedWorld() {
+	VerletJS* sim = new VerletJS(1200, 800);
+	new Cloth(sim, Vec2(300, 250), 300, 300, 20, 4, 0.9);
+	Spiderweb* spiderweb = new Spiderweb(sim, Vec2(800, 300), 150, 20, 7);
+	new Spider(sim, spiderweb, Vec2(800, -100));
+	new Tree(sim, Vec2(600, 700), 6, 70, 0.95, (M_PI/2)/3);
+	return sim;
+}
+
+// the two trees of the demo, without gravity, which come to rest
+VerletJS* restingWorld() {
+	VerletJS* sim = new VerletJS(800, 500);
+	sim->gravity = Vec2(0,0);
+	sim->friction = 0.98;
+	new Tree(sim, Vec2(200, 380), 5, 70, 0.95, (M_PI/2)/3);
+	new Tree(sim, Vec2(600, 380), 5, 70, 0.95, (M_PI/2)/3);
+	return sim;
+}
+
+// running each group of composites as a task steps exactly as the serial loop,
+// through a drag of the cloth and the spider moving its legs
+void test_Tasks() {
+	ThreadPool pool(4);
+	VerletJS* serial = mixedWorld();
+	VerletJS* tasks = mixedWorld();
+	tasks->pool = &pool;
+	tasks->parallelComposites = true;
+	
+	VerletJS* sims[2] = {serial, tasks};
+	Vec2 corner;
+	bool same = true, dragged = false;
+	int s, k;
+	for (s=0; s<300; s++) {
+		for (k=0; k<2; k++) {
+			if (s == 60) {
+				corner = sims[k]->composites[0]->particles.back()->getPos();
+				sims[k]->onMouseClick(0, true, corner.x, corner.y);
+				dragged = sims[k]->draggedEntity != NULL;
+			}
+			if (s >= 60 && s < 120)
+				sims[k]->onMouseMove(corner.x + s - 60, corner.y + 2*(s - 60));
+			if (s == 120)
+				sims[k]->onMouseClick(0, false, corner.x + 60, corner.y + 120);
+			sims[k]->update(1.0f/60);
+		}
+		same &= serial->store.x == tasks->store.x && serial->store.y == tasks->store.y;
+	}
+	
+	// an edit that keeps the counts still regroups
+	int revision = tasks->groupedRevision;
+	tasks->composites[0]->invalidate();
+	tasks->update(1.0f/60);
+	bool regrouped = tasks->groupedRevision != revision;
+	
+	cout << "VerletJS(tasks): " << (same && dragged && regrouped && tasks->grouped ? "PASS" : "FAIL") << "\n";
+	delete serial;
+	delete tasks;
+}
+
+// adaptive relaxation with no tolerance runs every iteration as the fixed count
+// does, drops to minIterations once a scene rests, and never runs more than step
+void test_Adaptive() {
+	bool same = true, bounded = true, rested = true;
+	int s, k, c, mode;
+	for (mode=0; mode<2; mode++) {
+		VerletJS* fixed = mixedWorld();
+		VerletJS* adaptive = mixedWorld();
+		adaptive->adaptive = true;
+		adaptive->tolerance = 0;
+		fixed->collisions = adaptive->collisions = mode == 1;
+		
+		VerletJS* sims[2] = {fixed, adaptive};
+		for (s=0; s<120; s++) {
+			for (k=0; k<2; k++) {
+				if (s == 30) {
+					Vec2 corner = sims[k]->composites[0]->particles.back()->getPos();
+					sims[k]->onMouseClick(0, true, corner.x, corner.y);
+				}
+				if (s >= 30)
+					sims[k]->onMouseMove(300 + 4*s, 250 + 2*s);
+				sims[k]->update(1.0f/60);
+			}
+			same &= fixed->store.x == adaptive->store.x && fixed->store.y == adaptive->store.y;
+		}
+		delete fixed;
+		delete adaptive;
+	}
+	
+	// pulled hard, with the default tolerance and several counts of iterations
+	VerletJS* sim = mixedWorld();
+	sim->adaptive = true;
+	Vec2 corner = sim->composites[0]->particles.back()->getPos();
+	sim->onMouseClick(0, true, corner.x, corner.y);
+	for (s=0; s<120; s++) {
+		int step = 4 + s%3*6;
+		sim->onMouseMove(300 + 6*s, 250 + 3*s);
+		sim->update(1.0f/60, step);
+		bounded &= sim->iterations >= 1 && sim->iterations <= step;
+		for (c=0; c<sim->composites.size(); c++)
+			bounded &= sim->composites[c]->iterations <= step;
+	}
+	delete sim;
+	
+	// the trees of the demo come to rest
+	sim = restingWorld();
+	sim->adaptive = true;
+	for (s=0; s<600; s++)
+		sim->update(1.0f/60);
+	for (s=0; s<10; s++) {
+		sim->update(1.0f/60);
+		rested &= sim->iterations == sim->minIterations;
+	}
+	delete sim;
+	
+	cout << "VerletJS(adaptive): " << (same && bounded && rested ? "PASS" : "FAIL") << "\n";
+}
+
+// a pinned cloth and a rope pinned at both ends, which hang still under gravity
+VerletJS* hangingWorld() {
+	VerletJS* sim = new VerletJS(800, 500);
+	sim->friction = 0.95;
+	new Cloth(sim, Vec2(250, 200), 300, 300, 15, 3, 0.9);
+	
+	Vec2 vertices[16];
+	int i;
+	for (i=0; i<16; i++)
+		vertices[i] = Vec2(500 + i*15, 100);
+	Composite* rope = new LineSegments(sim, vertices, 0.5);
+	rope->pin(0);
+	rope->pin(15);
+	return sim;
+}
+
+// the hanging cloth and rope fall asleep and stay in place under gravity; a drag
+// wakes the dragged rope only, an invalidate() its composite, and a change of
+// gravity every one
+void test_Sleep() {
+	VerletJS* sim = hangingWorld();
+	sim->sleep = true;
+	Composite* cloth = sim->composites[0];
+	Composite* rope = sim->composites[1];
+	
+	int s;
+	for (s=0; s<1000 && sim->sleepingComposites() < 2; s++)
+		sim->update(1.0f/60);
+	bool slept = sim->sleepingComposites() == 2;
+	
+	vector<float> x = sim->store.x, y = sim->store.y;
+	for (s=0; s<60; s++)
+		sim->update(1.0f/60);
+	bool still = sim->store.x == x && sim->store.y == y && sim->sleepingComposites() == 2;
+	
+	// the cloth sleeps on, in place, while the rope is dragged
+	Vec2 middle = rope->particles[8]->getPos();
+	sim->onMouseClick(0, true, middle.x, middle.y);
+	bool dragged = true;
+	for (s=0; s<30; s++) {
+		sim->onMouseMove(middle.x, middle.y + 2*s);
+		sim->update(1.0f/60);
+		dragged &= !rope->sleeping && cloth->sleeping;
+	}
+	for (s=cloth->begin(); s<cloth->end(); s++)
+		dragged &= sim->store.x[s] == x[s] && sim->store.y[s] == y[s];
+	sim->onMouseClick(0, false, middle.x, middle.y + 60);
+	
+	for (s=0; s<1000 && sim->sleepingComposites() < 2; s++)
+		sim->update(1.0f/60);
+	bool invalidated = sim->sleepingComposites() == 2;
+	cloth->invalidate();
+	sim->update(1.0f/60);
+	invalidated &= !cloth->sleeping && rope->sleeping;
+	
+	for (s=0; s<1000 && sim->sleepingComposites() < 2; s++)
+		sim->update(1.0f/60);
+	bool gravity = sim->sleepingComposites() == 2;
+	sim->gravity = Vec2(0.1, 0.2);
+	sim->update(1.0f/60);
+	gravity &= sim->sleepingComposites() == 0;
+	
+	cout << "VerletJS(sleep): " << (slept && still && dragged && invalidated && gravity ? "PASS" : "FAIL") << "\n";
+	delete sim;
+}
@@ -2,6 +2,7 @@
 
 #include <GLUT/GLUT.h>
 #include <sys/time.h>
+#include <stdarg.h>
 
 static double seconds() {
 	struct timeval t;